@@ -0,0 +1,508 @@
+#define _GNU_SOURCE // nftw
+
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+// Benchmarks of the write and read paths, one JSON line per benchmark
+// tagged with the library version so runs can be compared. Every read
+// benchmark checks it saw the records written and the run fails when one
+// did not, which is what make check relies on.
+
+#ifndef ACELOG_VERSION
+#define ACELOG_VERSION "unknown"
+#endif
+
+#define kDataSize (16)
+#define kBatch (1000)
+#define kMaxVariable (64) // largest variable size record
+
+typedef struct {
+  const char *path; // scratch directory, removed afterwards
+  bool quick;
+  int failures;
+  uint64_t start; // epoch millis of the read dataset
+  uint64_t end;
+  uint64_t records;
+} bench_t;
+
+static double seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// upper bound of the bucket holding quantile q of a histogram
+static uint64_t quantile(const log_histogram_t *histogram, double q) {
+  uint64_t wanted = (uint64_t)(histogram->count * q);
+  uint64_t seen = 0;
+  int bucket;
+  for (bucket = 0; bucket < log_kHistogramBuckets; bucket++) {
+    seen += histogram->buckets[bucket];
+    if ((seen > wanted) && (seen != 0))
+      return bucket == 0 ? 0 : 1ULL << bucket;
+  }
+  return histogram->max;
+}
+
+static void report(const char *name, uint64_t count, double elapsed,
+                   const log_histogram_t *histogram) {
+  printf("{\"version\":\"%s\",\"bench\":\"%s\",\"count\":%llu,"
+         "\"seconds\":%.6f,\"perSecond\":%.0f",
+         ACELOG_VERSION, name, (unsigned long long)count, elapsed,
+         elapsed > 0 ? count / elapsed : 0.0);
+  if ((histogram != NULL) && (histogram->count != 0))
+    printf(",\"meanNanos\":%llu,\"p50Nanos\":%llu,\"p99Nanos\":%llu,"
+           "\"maxNanos\":%llu",
+           (unsigned long long)(histogram->sum / histogram->count),
+           (unsigned long long)quantile(histogram, 0.5),
+           (unsigned long long)quantile(histogram, 0.99),
+           (unsigned long long)histogram->max);
+  printf("}\n");
+  fflush(stdout);
+}
+
+static void check(bench_t *bench, const char *name, uint64_t seen,
+                  uint64_t expected) {
+  if (seen == expected)
+    return;
+  fprintf(stderr, "Error : %s Saw %llu Records, Expected %llu\n", name,
+          (unsigned long long)seen, (unsigned long long)expected);
+  bench->failures++;
+}
+
+static void directory(const bench_t *bench, const char *name, char *path) {
+  snprintf(path, log_kMaxStrLen, "%s/%s", bench->path, name);
+}
+
+// log_commit at wall clock time, timing each commit and flush
+static void benchCommit(bench_t *bench) {
+  char path[log_kMaxStrLen];
+  directory(bench, "commit", path);
+  log_t logger;
+  log_config_t config = {.path = path, .dataSize = kDataSize, .timing = true};
+  log_open(&logger, &config);
+  uint64_t count = bench->quick ? 200000 : 5000000;
+  unsigned char data[kDataSize] = {0};
+  double start = seconds();
+  uint64_t index;
+  for (index = 0; index < count; index++) {
+    memcpy(data, &index, sizeof(index));
+    log_commit(&logger, data);
+  }
+  log_end(&logger);
+  double elapsed = seconds() - start;
+  log_stats_t stats;
+  log_stats(&logger, &stats, false);
+  report("commit", count, elapsed, &stats.commitNanos);
+  report("flush", stats.flushNanos.count,
+         stats.flushNanos.sum * 1e-9, &stats.flushNanos);
+}
+
+// log_commitBatch of caller stamped records, which also writes the dataset
+// the read benchmarks use: days of records every 100ms
+static void benchBatch(bench_t *bench) {
+  char path[log_kMaxStrLen];
+  directory(bench, "read", path);
+  log_t logger;
+  log_config_t config = {.path = path, .dataSize = kDataSize};
+  log_open(&logger, &config);
+  int days = bench->quick ? 2 : 7;
+  uint64_t count = (uint64_t)days * 864000;
+  struct timespec stamps[kBatch];
+  unsigned char records[kBatch * kDataSize] = {0};
+  bench->start = 1700006400000ULL; // 2023-11-15 00:00 UTC
+  double start = seconds();
+  uint64_t index;
+  for (index = 0; index < count; index += kBatch) {
+    int record;
+    for (record = 0; record < kBatch; record++) {
+      uint64_t millis = bench->start + (index + record) * 100;
+      stamps[record].tv_sec = millis / 1000;
+      stamps[record].tv_nsec = (millis % 1000) * 1000000;
+      uint64_t value = index + record;
+      memcpy(&records[record * kDataSize], &value, sizeof(value));
+    }
+    log_commitBatch(&logger, stamps, records, kBatch);
+  }
+  log_end(&logger);
+  double elapsed = seconds() - start;
+  bench->records = count;
+  bench->end = bench->start + count * 100;
+  report("commitBatch", count, elapsed, NULL);
+}
+
+// random log_seek then the record found
+static void benchSeek(bench_t *bench) {
+  char path[log_kMaxStrLen];
+  directory(bench, "read", path);
+  log_t logger;
+  log_config_t config = {.path = path, .dataSize = kDataSize, .timing = true};
+  log_open(&logger, &config);
+  uint64_t count = bench->quick ? 20000 : 200000;
+  uint64_t found = 0;
+  uint64_t random = 88172645463325252ULL;
+  double start = seconds();
+  uint64_t index;
+  for (index = 0; index < count; index++) {
+    random ^= random << 13;
+    random ^= random >> 7;
+    random ^= random << 17;
+    uint64_t millis = bench->start + random % (bench->end - bench->start - 100);
+    struct timespec ts = {millis / 1000, (millis % 1000) * 1000000};
+    if (log_seek(&logger, &ts) && (log_nextPtr(&logger, &ts) != NULL))
+      found++;
+  }
+  double elapsed = seconds() - start;
+  log_stats_t stats;
+  log_stats(&logger, &stats, false);
+  log_end(&logger);
+  report("seek", count, elapsed, &stats.seekNanos);
+  check(bench, "seek", found, count);
+}
+
+// sequential log_read, the cursor fast path
+static void benchRead(bench_t *bench) {
+  char path[log_kMaxStrLen];
+  directory(bench, "read", path);
+  log_t logger;
+  log_begin(&logger, path, kDataSize);
+  struct timespec ts = {bench->start / 1000 - 1, 0};
+  unsigned char data[kDataSize];
+  uint64_t count = 0;
+  double start = seconds();
+  while (log_read(&logger, &ts, data))
+    count++;
+  double elapsed = seconds() - start;
+  log_end(&logger);
+  report("read", count, elapsed, NULL);
+  check(bench, "read", count, bench->records);
+}
+
+// log_nextPtr from the first record, no copy
+static void benchScan(bench_t *bench) {
+  char path[log_kMaxStrLen];
+  directory(bench, "read", path);
+  log_t logger;
+  log_beginMapped(&logger, path, kDataSize);
+  struct timespec ts = {bench->start / 1000 - 1, 0};
+  uint64_t count = 0;
+  double start = seconds();
+  if (log_seek(&logger, &ts)) {
+    while (log_nextPtr(&logger, &ts) != NULL)
+      count++;
+  }
+  double elapsed = seconds() - start;
+  log_end(&logger);
+  report("scan", count, elapsed, NULL);
+  check(bench, "scan", count, bench->records);
+}
+
+// log_prev from the last record back to the first
+static void benchPrev(bench_t *bench) {
+  char path[log_kMaxStrLen];
+  directory(bench, "read", path);
+  log_t logger;
+  log_begin(&logger, path, kDataSize);
+  struct timespec ts = {bench->end / 1000 + 1, 0};
+  unsigned char data[kDataSize];
+  uint64_t count = 0;
+  double start = seconds();
+  while (log_prev(&logger, &ts, data))
+    count++;
+  double elapsed = seconds() - start;
+  log_end(&logger);
+  report("prev", count, elapsed, NULL);
+  check(bench, "prev", count, bench->records);
+}
+
+// repeated log_latest of the newest record, the current value lookup
+static void benchLatest(bench_t *bench) {
+  char path[log_kMaxStrLen];
+  directory(bench, "read", path);
+  log_t logger;
+  log_begin(&logger, path, kDataSize);
+  uint64_t count = bench->quick ? 2000 : 20000;
+  uint64_t found = 0;
+  unsigned char data[kDataSize];
+  double start = seconds();
+  uint64_t index;
+  for (index = 0; index < count; index++) {
+    uint64_t value = 0;
+    if (log_latest(&logger, 1, NULL, data) == 1)
+      memcpy(&value, data, sizeof(value));
+    if (value == bench->records - 1)
+      found++;
+  }
+  double elapsed = seconds() - start;
+  log_end(&logger);
+  report("latest", count, elapsed, NULL);
+  check(bench, "latest", found, count);
+}
+
+// log_commitSizes of records of 8 to kMaxVariable bytes every 100ms over a
+// day, then log_read of them all checking each size, and random seeks
+static void benchVariable(bench_t *bench) {
+  char path[log_kMaxStrLen];
+  directory(bench, "variable", path);
+  log_t logger;
+  log_config_t config = {.path = path, .dataSize = kMaxVariable,
+                         .variable = true};
+  log_open(&logger, &config);
+  uint64_t count = 864000;
+  uint64_t first = bench->start;
+  struct timespec stamps[kBatch];
+  int sizes[kBatch];
+  unsigned char records[kBatch * kMaxVariable] = {0};
+  double start = seconds();
+  uint64_t index;
+  for (index = 0; index < count; index += kBatch) {
+    unsigned char *record = records;
+    int batch;
+    for (batch = 0; batch < kBatch; batch++) {
+      uint64_t value = index + batch;
+      uint64_t millis = first + value * 100;
+      stamps[batch].tv_sec = millis / 1000;
+      stamps[batch].tv_nsec = (millis % 1000) * 1000000;
+      sizes[batch] = 8 + (int)(value % (kMaxVariable - 7));
+      memcpy(record, &value, sizeof(value));
+      record += sizes[batch];
+    }
+    log_commitSizes(&logger, stamps, records, sizes, kBatch);
+  }
+  log_end(&logger);
+  report("commitSizes", count, seconds() - start, NULL);
+
+  log_open(&logger, &config);
+  struct timespec ts = {first / 1000 - 1, 0};
+  unsigned char data[kMaxVariable];
+  uint64_t seen = 0;
+  int size;
+  start = seconds();
+  while ((size = log_read(&logger, &ts, data)) != 0) {
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    if ((value != seen) || (size != 8 + (int)(value % (kMaxVariable - 7))))
+      break;
+    seen++;
+  }
+  report("variableRead", seen, seconds() - start, NULL);
+  check(bench, "variableRead", seen, count);
+
+  uint64_t seeks = bench->quick ? 20000 : 200000;
+  uint64_t found = 0;
+  uint64_t random = 88172645463325252ULL;
+  start = seconds();
+  for (index = 0; index < seeks; index++) {
+    random ^= random << 13;
+    random ^= random >> 7;
+    random ^= random << 17;
+    uint64_t wanted = random % count;
+    uint64_t millis = first + wanted * 100 - 1;
+    ts.tv_sec = millis / 1000;
+    ts.tv_nsec = (millis % 1000) * 1000000;
+    uint64_t value = UINT64_MAX;
+    if (log_read(&logger, &ts, data) != 0)
+      memcpy(&value, data, sizeof(value));
+    found += value == wanted;
+  }
+  report("variableSeek", seeks, seconds() - start, NULL);
+  check(bench, "variableSeek", found, seeks);
+  log_end(&logger);
+}
+
+// log_commitBatch of a 50kHz sensor stamped in micros, 50 records to each
+// millisecond, then log_read of them all checking each stamp
+static void benchMicros(bench_t *bench) {
+  char path[log_kMaxStrLen];
+  directory(bench, "micros", path);
+  log_t logger;
+  log_config_t config = {.path = path, .dataSize = kDataSize,
+                         .resolution = log_kMicros};
+  log_open(&logger, &config);
+  uint64_t count = bench->quick ? 360000 : 3600000;
+  uint64_t first = bench->start * 1000;
+  struct timespec stamps[kBatch];
+  unsigned char records[kBatch * kDataSize] = {0};
+  double start = seconds();
+  uint64_t index;
+  for (index = 0; index < count; index += kBatch) {
+    int record;
+    for (record = 0; record < kBatch; record++) {
+      uint64_t micros = first + (index + record) * 20;
+      stamps[record].tv_sec = micros / 1000000;
+      stamps[record].tv_nsec = (micros % 1000000) * 1000;
+      uint64_t value = index + record;
+      memcpy(&records[record * kDataSize], &value, sizeof(value));
+    }
+    log_commitBatch(&logger, stamps, records, kBatch);
+  }
+  log_end(&logger);
+  report("microsBatch", count, seconds() - start, NULL);
+
+  log_open(&logger, &config);
+  struct timespec ts = {first / 1000000 - 1, 0};
+  unsigned char data[kDataSize];
+  uint64_t seen = 0;
+  start = seconds();
+  while (log_read(&logger, &ts, data)) {
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    if ((value != seen) || (log_micros(&ts) != first + value * 20))
+      break;
+    seen++;
+  }
+  report("microsRead", seen, seconds() - start, NULL);
+  check(bench, "microsRead", seen, count);
+  log_end(&logger);
+}
+
+static bool countBlock(const log_block_t *block, void *context) {
+  *(uint64_t *)context += block->count;
+  return true;
+}
+
+// log_query over every day of the dataset
+static void benchRangeScan(bench_t *bench) {
+  char path[log_kMaxStrLen];
+  directory(bench, "read", path);
+  log_t logger;
+  log_begin(&logger, path, kDataSize);
+  uint64_t count = 0;
+  double start = seconds();
+  long total = log_query(&logger, bench->start, bench->end, countBlock, &count);
+  double elapsed = seconds() - start;
+  log_end(&logger);
+  report("rangeScan", count, elapsed, NULL);
+  check(bench, "rangeScan", (uint64_t)total, bench->records);
+}
+
+// sum of the first data word of each record in an hour
+static void sumHour(const log_block_t *block, void *result, void *context) {
+  (void)context;
+  uint64_t sum = 0;
+  int index;
+  for (index = 0; index < block->count; index++) {
+    uint64_t value;
+    memcpy(&value, &block->records[index * block->recordSize + 4],
+           sizeof(value));
+    sum += value;
+  }
+  *(uint64_t *)result = sum;
+}
+
+typedef struct {
+  uint64_t sum;
+  time_t hour; // last hour merged, which must only go up
+  bool ordered;
+} hourSums_t;
+
+static bool mergeSum(const log_block_t *block, const void *result,
+                     void *context) {
+  hourSums_t *sums = (hourSums_t *)context;
+  sums->ordered = sums->ordered && (block->hour > sums->hour);
+  sums->hour = block->hour;
+  sums->sum += *(const uint64_t *)result;
+  return true;
+}
+
+// log_queryParallel over every day, summing on the pool threads
+static void benchParallelScan(bench_t *bench) {
+  char path[log_kMaxStrLen];
+  directory(bench, "read", path);
+  log_t logger;
+  log_begin(&logger, path, kDataSize);
+  hourSums_t sums = {.ordered = true};
+  double start = seconds();
+  long total = log_queryParallel(&logger, bench->start, bench->end, 0, sumHour,
+                                 sizeof(uint64_t), mergeSum, &sums);
+  double elapsed = seconds() - start;
+  log_end(&logger);
+  report("parallelScan", (uint64_t)total, elapsed, NULL);
+  check(bench, "parallelScan", (uint64_t)total, bench->records);
+  // values are the record numbers
+  uint64_t expected = bench->records * (bench->records - 1) / 2;
+  if (!sums.ordered || (sums.sum != expected)) {
+    fprintf(stderr, "Error : parallelScan Merged Out Of Order or Wrong\n");
+    bench->failures++;
+  }
+}
+
+// hourly log_aggregate of the low word of the record numbers
+static void benchAggregate(bench_t *bench) {
+  char path[log_kMaxStrLen];
+  directory(bench, "read", path);
+  log_t logger;
+  log_begin(&logger, path, kDataSize);
+  log_field_t field = {.name = "value", .offset = 0, .type = log_kUint32};
+  log_setSchema(&logger, &field, 1);
+  long hours = (long)((bench->end - bench->start) / 3600000);
+  log_aggregate_t *buckets = malloc(hours * sizeof(log_aggregate_t));
+  double start = seconds();
+  long filled = log_aggregate(&logger, 0, bench->start, bench->end, 3600000,
+                              0, buckets, hours);
+  double elapsed = seconds() - start;
+  log_end(&logger);
+  uint64_t count = 0;
+  double sum = 0;
+  long hour;
+  for (hour = 0; hour < filled; hour++) {
+    count += buckets[hour].count;
+    sum += buckets[hour].sum;
+  }
+  free(buckets);
+  report("aggregate", count, elapsed, NULL);
+  check(bench, "aggregate", count, bench->records);
+  if (sum != (double)(bench->records * (bench->records - 1) / 2)) {
+    fprintf(stderr, "Error : aggregate Sum Wrong\n");
+    bench->failures++;
+  }
+}
+
+static int removeEntry(const char *path, const struct stat *sb, int flag,
+                       struct FTW *ftw) {
+  (void)sb;
+  (void)flag;
+  (void)ftw;
+  return remove(path);
+}
+
+int main(int argc, char **argv) {
+  char scratch[log_kMaxStrLen];
+  snprintf(scratch, sizeof(scratch), "/tmp/acelog-bench-%d", (int)getpid());
+  bench_t bench = {.path = scratch};
+  int option;
+  while ((option = getopt(argc, argv, "qo:")) != -1) {
+    switch (option) {
+    case 'q':
+      bench.quick = true;
+      break;
+    case 'o':
+      bench.path = optarg;
+      break;
+    default:
+      fprintf(stderr, "usage: acelog-bench [-q] [-o scratch]\n");
+      return 2;
+    }
+  }
+  nftw(bench.path, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+  benchCommit(&bench);
+  benchBatch(&bench);
+  benchSeek(&bench);
+  benchRead(&bench);
+  benchScan(&bench);
+  benchPrev(&bench);
+  benchLatest(&bench);
+  benchVariable(&bench);
+  benchMicros(&bench);
+  benchRangeScan(&bench);
+  benchParallelScan(&bench);
+  benchAggregate(&bench);
+  nftw(bench.path, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+  return bench.failures == 0 ? 0 : 1;
+}
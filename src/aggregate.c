@@ -0,0 +1,328 @@
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+// Aggregation gathers a field of a run of records falling in one bucket
+// into a chunk of doubles, one tight loop per type and byte order, then
+// reduces the chunk four lanes at a time. Hours are aggregated by the
+// workers of log_queryParallel into partials for the buckets they cover,
+// which the merge folds into the caller's buckets in hour order.
+
+#define kChunkValues (256)
+
+typedef double lanes_t __attribute__((vector_size(32)));
+typedef int64_t laneMask_t __attribute__((vector_size(32)));
+#define kLanes (sizeof(lanes_t) / sizeof(double))
+
+typedef struct {
+  log_field_t field;
+  int fieldOffset; // bytes into each log record
+  uint64_t start;
+  uint64_t bucketMillis;
+  long buckets;
+  log_aggregate_t *out;
+  bool failed; // a worker could not allocate its partials
+} aggregation_t;
+
+// buckets of one hour, from first, partials is single for one bucket
+typedef struct {
+  long first;
+  long count;
+  log_aggregate_t *partials;
+  log_aggregate_t single;
+} hourPartials_t;
+
+// register the layout of the data, replacing any earlier schema, false
+// when a field does not fit in dataSize or records are variable size
+bool log_setSchema(log_t *logger, const log_field_t *fields, int count) {
+  static const int sizes[] = {[log_kInt16] = 2,  [log_kUint16] = 2,
+                              [log_kInt32] = 4,  [log_kUint32] = 4,
+                              [log_kFloat] = 4,  [log_kDouble] = 8};
+  if ((count < 0) || (count > log_kMaxFields) || logger->variable)
+    return false;
+  int index;
+  for (index = 0; index < count; index++) {
+    const log_field_t *field = &fields[index];
+    if (((unsigned)field->type > log_kDouble) || (field->offset < 0) ||
+        (field->offset + sizes[field->type] > logger->dataSize)) {
+      fprintf(stderr, "Error : Log Schema Field %d Out Of Range\n", index);
+      return false;
+    }
+  }
+  memcpy(logger->fields, fields, count * sizeof(log_field_t));
+  for (index = 0; index < count; index++)
+    logger->fields[index].name[log_kMaxFieldName - 1] = '\0';
+  logger->fieldCount = count;
+  return true;
+}
+
+// index of the schema field called name, -1 when there is none
+int log_field(log_t *logger, const char *name) {
+  int index;
+  for (index = 0; index < logger->fieldCount; index++) {
+    if (strncmp(logger->fields[index].name, name, log_kMaxFieldName) == 0)
+      return index;
+  }
+  return -1;
+}
+
+// fold count values into aggregate
+static void reduceValues(const double *values, int count,
+                         log_aggregate_t *aggregate) {
+  int index = 0;
+  double min = aggregate->count ? aggregate->min : values[0];
+  double max = aggregate->count ? aggregate->max : values[0];
+  double sum = 0;
+  if (count >= (int)kLanes) {
+    lanes_t lanes;
+    memcpy(&lanes, values, sizeof(lanes));
+    lanes_t mins = lanes, maxs = lanes, sums = lanes;
+    for (index = kLanes; index + (int)kLanes <= count; index += kLanes) {
+      memcpy(&lanes, &values[index], sizeof(lanes));
+      laneMask_t less = (laneMask_t)(lanes < mins);
+      laneMask_t more = (laneMask_t)(lanes > maxs);
+      mins = (lanes_t)((less & (laneMask_t)lanes) | (~less & (laneMask_t)mins));
+      maxs = (lanes_t)((more & (laneMask_t)lanes) | (~more & (laneMask_t)maxs));
+      sums += lanes;
+    }
+    unsigned int lane;
+    for (lane = 0; lane < kLanes; lane++) {
+      min = mins[lane] < min ? mins[lane] : min;
+      max = maxs[lane] > max ? maxs[lane] : max;
+      sum += sums[lane];
+    }
+  }
+  for (; index < count; index++) {
+    min = values[index] < min ? values[index] : min;
+    max = values[index] > max ? values[index] : max;
+    sum += values[index];
+  }
+  aggregate->count += count;
+  aggregate->min = min;
+  aggregate->max = max;
+  aggregate->sum += sum;
+}
+
+#define GATHER(type, load)                                                    \
+  for (index = 0; index < count; index++) {                                   \
+    type value;                                                               \
+    load;                                                                     \
+    values[index] = (double)value;                                            \
+  }
+
+// convert field of count records, stride bytes apart, into values
+static void gatherValues(const unsigned char *field, int count, int stride,
+                         const log_field_t *schema, double *values) {
+  int index;
+  const unsigned char *at;
+  if (!schema->bigEndian) {
+    switch (schema->type) {
+    case log_kInt16:
+      GATHER(int16_t, memcpy(&value, field + index * stride, 2));
+      break;
+    case log_kUint16:
+      GATHER(uint16_t, memcpy(&value, field + index * stride, 2));
+      break;
+    case log_kInt32:
+      GATHER(int32_t, memcpy(&value, field + index * stride, 4));
+      break;
+    case log_kUint32:
+      GATHER(uint32_t, memcpy(&value, field + index * stride, 4));
+      break;
+    case log_kFloat:
+      GATHER(float, memcpy(&value, field + index * stride, 4));
+      break;
+    case log_kDouble:
+      GATHER(double, memcpy(&value, field + index * stride, 8));
+      break;
+    }
+    return;
+  }
+  uint16_t bits16;
+  uint32_t bits32;
+  uint64_t bits64;
+  switch (schema->type) {
+  case log_kInt16:
+    GATHER(int16_t, at = field + index * stride; memcpy(&bits16, at, 2);
+           value = (int16_t)ntohs(bits16));
+    break;
+  case log_kUint16:
+    GATHER(uint16_t, at = field + index * stride; memcpy(&bits16, at, 2);
+           value = ntohs(bits16));
+    break;
+  case log_kInt32:
+    GATHER(int32_t, at = field + index * stride; memcpy(&bits32, at, 4);
+           value = (int32_t)ntohl(bits32));
+    break;
+  case log_kUint32:
+    GATHER(uint32_t, at = field + index * stride; memcpy(&bits32, at, 4);
+           value = ntohl(bits32));
+    break;
+  case log_kFloat:
+    GATHER(float, at = field + index * stride; memcpy(&bits32, at, 4);
+           bits32 = ntohl(bits32); memcpy(&value, &bits32, 4));
+    break;
+  case log_kDouble:
+    GATHER(double, at = field + index * stride; memcpy(&bits64, at, 8);
+           bits64 = __builtin_bswap64(bits64); memcpy(&value, &bits64, 8));
+    break;
+  }
+}
+
+// fold the field of count records into aggregate, a chunk at a time
+static void aggregateRun(const aggregation_t *aggregation,
+                         const unsigned char *records, int count,
+                         int recordSize, log_aggregate_t *aggregate) {
+  double values[kChunkValues];
+  const unsigned char *field = records + aggregation->fieldOffset;
+  while (count > 0) {
+    int chunk = count < kChunkValues ? count : kChunkValues;
+    gatherValues(field, chunk, recordSize, &aggregation->field, values);
+    reduceValues(values, chunk, aggregate);
+    field += chunk * recordSize;
+    count -= chunk;
+  }
+}
+
+static uint32_t recordMillis(const unsigned char *record) {
+  uint32_t millis;
+  memcpy(&millis, record, sizeof(millis));
+  return ntohl(millis);
+}
+
+// index of the first of count records at or after time from the hour
+static int runEnd(const unsigned char *records, int count, int recordSize,
+                  uint64_t time) {
+  int low = 0, high = count;
+  while (low < high) {
+    int middle = low + (high - low) / 2;
+    if (recordMillis(&records[middle * recordSize]) < time)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+static long bucketOf(const aggregation_t *aggregation, uint64_t millis) {
+  return (long)((millis - aggregation->start) / aggregation->bucketMillis);
+}
+
+static void aggregateHour(const log_block_t *block, void *result,
+                          void *context) {
+  const aggregation_t *aggregation = context;
+  hourPartials_t *partials = result;
+  uint64_t hourMillis = (uint64_t)block->hour * 1000LL;
+  const unsigned char *records = block->records;
+  int recordSize = block->recordSize;
+  int count = block->count;
+  int units = block->unitsPerMilli; // of record times
+  if (count == 0)
+    return;
+  partials->first =
+      bucketOf(aggregation, hourMillis + recordMillis(records) / units);
+  long last = bucketOf(
+      aggregation,
+      hourMillis + recordMillis(&records[(count - 1) * recordSize]) / units);
+  partials->count = last - partials->first + 1;
+  partials->partials = &partials->single;
+  if (partials->count > 1) {
+    partials->partials = calloc(partials->count, sizeof(log_aggregate_t));
+    if (partials->partials == NULL) {
+      partials->count = 0;
+      return;
+    }
+  }
+  int index = 0;
+  while (index < count) {
+    const unsigned char *run = &records[index * recordSize];
+    long bucket =
+        bucketOf(aggregation, hourMillis + recordMillis(run) / units);
+    uint64_t bucketEnd = aggregation->start +
+                         (uint64_t)(bucket + 1) * aggregation->bucketMillis;
+    int end = count;
+    if (bucketEnd - hourMillis < 3600000LL)
+      end = index + runEnd(run, count - index, recordSize,
+                           (bucketEnd - hourMillis) * units);
+    aggregateRun(aggregation, run, end - index, recordSize,
+                 &partials->partials[bucket - partials->first]);
+    index = end;
+  }
+}
+
+static bool mergeHour(const log_block_t *block, const void *result,
+                      void *context) {
+  aggregation_t *aggregation = context;
+  const hourPartials_t *partials = result;
+  if ((partials->count == 0) && (block->count > 0))
+    aggregation->failed = true;
+  long index;
+  for (index = 0; index < partials->count; index++) {
+    const log_aggregate_t *partial = &partials->partials[index];
+    log_aggregate_t *bucket = &aggregation->out[partials->first + index];
+    if (partial->count == 0)
+      continue;
+    if ((bucket->count == 0) || (partial->min < bucket->min))
+      bucket->min = partial->min;
+    if ((bucket->count == 0) || (partial->max > bucket->max))
+      bucket->max = partial->max;
+    bucket->count += partial->count;
+    bucket->sum += partial->sum;
+  }
+  if (partials->partials != &partials->single)
+    free(partials->partials);
+  return true;
+}
+
+static bool aggregateBlock(const log_block_t *block, void *context) {
+  hourPartials_t partials = {0};
+  aggregateHour(block, &partials, context);
+  return mergeHour(block, &partials, context);
+}
+
+// aggregate a schema field over [start, end) into consecutive buckets of
+// bucketMillis from start (one bucket over the whole range when 0), using
+// threads pool threads as log_queryParallel does (none when 1), returns
+// the buckets filled, at most maxBuckets, or -1 on error
+long log_aggregate(log_t *logger, int field, uint64_t start, uint64_t end,
+                   uint64_t bucketMillis, int threads,
+                   log_aggregate_t *buckets, long maxBuckets) {
+  if ((field < 0) || (field >= logger->fieldCount) || (maxBuckets <= 0))
+    return -1;
+  if (end <= start)
+    return 0;
+  aggregation_t aggregation = {
+      .field = logger->fields[field],
+      .fieldOffset = (int)sizeof(uint32_t) +
+                     (logger->sourced ? log_kSourceSize : 0) +
+                     logger->fields[field].offset,
+      .start = start,
+      .bucketMillis = bucketMillis ? bucketMillis : end - start,
+      .out = buckets};
+  uint64_t count = (end - start - 1) / aggregation.bucketMillis + 1;
+  if (count > (uint64_t)maxBuckets) {
+    count = maxBuckets;
+    end = start + count * aggregation.bucketMillis;
+  }
+  aggregation.buckets = (long)count;
+  memset(buckets, 0, count * sizeof(log_aggregate_t));
+
+  long records;
+  if (threads == 1)
+    records = log_query(logger, start, end, aggregateBlock, &aggregation);
+  else
+    records =
+        log_queryParallel(logger, start, end, threads, aggregateHour,
+                          sizeof(hourPartials_t), mergeHour, &aggregation);
+  if ((records < 0) || aggregation.failed)
+    return -1;
+  long index;
+  for (index = 0; index < aggregation.buckets; index++) {
+    if (buckets[index].count)
+      buckets[index].mean = buckets[index].sum / buckets[index].count;
+  }
+  return aggregation.buckets;
+}
@@ -0,0 +1,278 @@
+#include <fcntl.h>
+#include <libgen.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "archive.h"
+
+// An archive packs the hour files of a day (DD.ach beside the month's day
+// directories) or of a month (MM.ach beside the year's month directories)
+// one after another, each copied as it was stored, raw or compressed. A
+// footer follows the data: an entry for each hour of its number from the
+// start of the archive, record count, first and last millis, offset and
+// size, then a trailer of magic, entry count, hours covered and start
+// time. All values are big endian like the record timestamps. Archives are
+// written to a temporary file and renamed into place, so a reader sees a
+// whole archive or none.
+
+#define kMagic (0x41434152) // "ACAR"
+#define kEntryWords (8)
+#define kTrailerWords (5)
+#define kCopySize (65536)
+
+static void putWide(uint32_t *words, uint64_t value) {
+  words[0] = htonl((uint32_t)(value >> 32));
+  words[1] = htonl((uint32_t)value);
+}
+
+static uint64_t getWide(const uint32_t *words) {
+  return ((uint64_t)ntohl(words[0]) << 32) | ntohl(words[1]);
+}
+
+void archive_init(archive_t *archive) {
+  archive->path[0] = '\0';
+  archive->fd = -1;
+  archive->count = 0;
+  archive->hours = NULL;
+}
+
+void archive_close(archive_t *archive) {
+  if (archive->fd >= 0)
+    close(archive->fd);
+  free(archive->hours);
+  archive_init(archive);
+}
+
+// open the archive at path and read its footer, keeping the one already
+// open when it is the same file, false when there is no valid archive
+bool archive_open(archive_t *archive, const char *path) {
+  struct stat sb;
+  if ((archive->fd >= 0) && (strcmp(archive->path, path) == 0) &&
+      (stat(path, &sb) == 0) && (sb.st_dev == archive->device) &&
+      (sb.st_ino == archive->inode))
+    return true;
+  archive_close(archive);
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  uint32_t trailer[kTrailerWords];
+  size_t trailerSize = sizeof(trailer);
+  if ((fstat(fd, &sb) < 0) || ((size_t)sb.st_size < trailerSize) ||
+      (pread(fd, trailer, trailerSize, sb.st_size - trailerSize) !=
+       (ssize_t)trailerSize) ||
+      (ntohl(trailer[0]) != kMagic) ||
+      (ntohl(trailer[1]) > archive_kMaxHours)) {
+    close(fd);
+    return false;
+  }
+  int count = ntohl(trailer[1]);
+  time_t start = (time_t)getWide(&trailer[3]);
+  size_t footerSize = count * kEntryWords * sizeof(uint32_t);
+  uint32_t *entries = malloc(footerSize + 1);
+  archive_hour_t *hours = malloc(count * sizeof(archive_hour_t) + 1);
+  if ((entries == NULL) || (hours == NULL) ||
+      ((size_t)sb.st_size < footerSize + trailerSize) ||
+      (pread(fd, entries, footerSize,
+             sb.st_size - trailerSize - footerSize) != (ssize_t)footerSize)) {
+    free(entries);
+    free(hours);
+    close(fd);
+    return false;
+  }
+  int index;
+  for (index = 0; index < count; index++) {
+    const uint32_t *entry = &entries[index * kEntryWords];
+    hours[index].hour = start + (time_t)ntohl(entry[0]) * 3600;
+    hours[index].summary.count = ntohl(entry[1]);
+    hours[index].summary.first = ntohl(entry[2]);
+    hours[index].summary.last = ntohl(entry[3]);
+    hours[index].summary.bytes = 0; // archives are never appended to
+    hours[index].offset = getWide(&entry[4]);
+    hours[index].size = getWide(&entry[6]);
+  }
+  free(entries);
+  snprintf(archive->path, sizeof(archive->path), "%s", path);
+  archive->device = sb.st_dev;
+  archive->inode = sb.st_ino;
+  archive->fd = fd;
+  archive->count = count;
+  archive->hours = hours;
+  return true;
+}
+
+// the archived hour starting at hour, NULL when it is not in the archive
+const archive_hour_t *archive_find(const archive_t *archive, time_t hour) {
+  int low = 0, high = archive->count;
+  while (low < high) {
+    int middle = low + (high - low) / 2;
+    if (archive->hours[middle].hour < hour)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  if ((low < archive->count) && (archive->hours[low].hour == hour))
+    return &archive->hours[low];
+  return NULL;
+}
+
+static void temporaryPath(const archive_writer_t *writer, char *path) {
+  snprintf(path, sizeof(writer->path) + 4, "%s.tmp", writer->path);
+}
+
+// start writing an archive of span hours from start, to be renamed to path
+// by archive_finish
+archive_writer_t *archive_create(const char *path, time_t start, int span) {
+  archive_writer_t *writer = malloc(sizeof(archive_writer_t));
+  if (writer == NULL)
+    return NULL;
+  char temporary[sizeof(writer->path) + 4];
+  snprintf(writer->path, sizeof(writer->path), "%s", path);
+  temporaryPath(writer, temporary);
+  writer->fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (writer->fd < 0) {
+    free(writer);
+    return NULL;
+  }
+  writer->start = start;
+  writer->span = span;
+  writer->count = 0;
+  writer->size = 0;
+  return writer;
+}
+
+static bool writeAll(int fd, const void *data, size_t size) {
+  const unsigned char *bytes = data;
+  while (size > 0) {
+    ssize_t written = write(fd, bytes, size);
+    if (written <= 0)
+      return false;
+    bytes += written;
+    size -= written;
+  }
+  return true;
+}
+
+// true when hour can go in next, hours go in in time order and the hour
+// last added may be extended
+static bool takesHour(const archive_writer_t *writer, time_t hour) {
+  if ((hour < writer->start) ||
+      (hour >= writer->start + (time_t)writer->span * 3600))
+    return false;
+  if (writer->count == 0)
+    return true;
+  time_t last = writer->hours[writer->count - 1].hour;
+  return (last == hour) ||
+         ((last < hour) && (writer->count < archive_kMaxHours));
+}
+
+// start or extend the entry of hour for size bytes just written
+static void addEntry(archive_writer_t *writer, time_t hour, uint64_t size,
+                     const index_hour_t *summary) {
+  archive_hour_t *last =
+      writer->count > 0 ? &writer->hours[writer->count - 1] : NULL;
+  if ((last != NULL) && (last->hour == hour)) {
+    last->size += size;
+    last->summary.count += summary->count;
+    last->summary.last = summary->last;
+  } else {
+    last = &writer->hours[writer->count++];
+    last->hour = hour;
+    last->offset = writer->size;
+    last->size = size;
+    last->summary = *summary;
+  }
+  writer->size += size;
+}
+
+// copy size bytes at offset of fd in as the data of hour, hours go in in
+// time order and adding the hour last added again extends it
+bool archive_add(archive_writer_t *writer, time_t hour, int fd, off_t offset,
+                 uint64_t size, const index_hour_t *summary) {
+  if (!takesHour(writer, hour))
+    return false;
+  unsigned char *chunk = malloc(kCopySize);
+  if (chunk == NULL)
+    return false;
+  uint64_t copied = 0;
+  while (copied < size) {
+    size_t length = size - copied < kCopySize ? size - copied : kCopySize;
+    ssize_t bytes = pread(fd, chunk, length, offset + copied);
+    if ((bytes <= 0) || !writeAll(writer->fd, chunk, bytes))
+      break;
+    copied += bytes;
+  }
+  free(chunk);
+  if (copied != size)
+    return false;
+  addEntry(writer, hour, size, summary);
+  return true;
+}
+
+// as archive_add, for data in memory
+bool archive_put(archive_writer_t *writer, time_t hour, const void *data,
+                 uint64_t size, const index_hour_t *summary) {
+  if (!takesHour(writer, hour) || !writeAll(writer->fd, data, size))
+    return false;
+  addEntry(writer, hour, size, summary);
+  return true;
+}
+
+// write the footer, make the archive durable and rename it into place,
+// frees the writer
+bool archive_finish(archive_writer_t *writer) {
+  size_t footerSize = writer->count * kEntryWords * sizeof(uint32_t);
+  uint32_t *footer = malloc(footerSize + kTrailerWords * sizeof(uint32_t));
+  bool done = false;
+  if (footer != NULL) {
+    int index;
+    for (index = 0; index < writer->count; index++) {
+      const archive_hour_t *hour = &writer->hours[index];
+      uint32_t *entry = &footer[index * kEntryWords];
+      entry[0] = htonl((uint32_t)((hour->hour - writer->start) / 3600));
+      entry[1] = htonl(hour->summary.count);
+      entry[2] = htonl(hour->summary.first);
+      entry[3] = htonl(hour->summary.last);
+      putWide(&entry[4], hour->offset);
+      putWide(&entry[6], hour->size);
+    }
+    uint32_t *trailer = &footer[writer->count * kEntryWords];
+    trailer[0] = htonl(kMagic);
+    trailer[1] = htonl(writer->count);
+    trailer[2] = htonl(writer->span);
+    putWide(&trailer[3], (uint64_t)writer->start);
+    done = writeAll(writer->fd, footer,
+                    footerSize + kTrailerWords * sizeof(uint32_t)) &&
+           (fdatasync(writer->fd) == 0);
+    free(footer);
+  }
+  close(writer->fd);
+  char temporary[sizeof(writer->path) + 4];
+  temporaryPath(writer, temporary);
+  if (done)
+    done = rename(temporary, writer->path) == 0;
+  if (!done) {
+    unlink(temporary);
+  } else {
+    // make the rename durable before the packed files go
+    int directory = open(dirname(temporary), O_RDONLY | O_DIRECTORY);
+    if (directory >= 0) {
+      fsync(directory);
+      close(directory);
+    }
+  }
+  free(writer);
+  return done;
+}
+
+// drop an archive being written, frees the writer
+void archive_abort(archive_writer_t *writer) {
+  char temporary[sizeof(writer->path) + 4];
+  temporaryPath(writer, temporary);
+  close(writer->fd);
+  unlink(temporary);
+  free(writer);
+}
@@ -0,0 +1,56 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "index.h"
+
+// hours in the longest archive, a month
+#define archive_kMaxHours (31 * 24)
+
+// one hour file packed into an archive
+typedef struct {
+  time_t hour;
+  uint64_t offset; // bytes from the start of the archive
+  uint64_t size;
+  index_hour_t summary;
+} archive_hour_t;
+
+// an archive open for reading, hours in time order
+typedef struct archive_s {
+  char path[4096];
+  dev_t device;
+  ino_t inode;
+  int fd; // -1 when none is open
+  int count;
+  archive_hour_t *hours;
+} archive_t;
+
+// an archive being written to a temporary file, see archive_create
+typedef struct {
+  char path[4096];
+  int fd;
+  time_t start;
+  int span; // hours covered
+  int count;
+  uint64_t size;
+  archive_hour_t hours[archive_kMaxHours];
+} archive_writer_t;
+
+void archive_init(archive_t *archive);
+bool archive_open(archive_t *archive, const char *path);
+void archive_close(archive_t *archive);
+const archive_hour_t *archive_find(const archive_t *archive, time_t hour);
+
+archive_writer_t *archive_create(const char *path, time_t start, int span);
+bool archive_add(archive_writer_t *writer, time_t hour, int fd, off_t offset,
+                 uint64_t size, const index_hour_t *summary);
+bool archive_put(archive_writer_t *writer, time_t hour, const void *data,
+                 uint64_t size, const index_hour_t *summary);
+bool archive_finish(archive_writer_t *writer);
+void archive_abort(archive_writer_t *writer);
+
+#endif // ARCHIVE_H
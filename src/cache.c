@@ -0,0 +1,225 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "codec.h"
+
+// Process wide cache of decoded hours, so readers of the same hours share
+// one copy rather than each reading and decoding its own. A block is found
+// by the file and offset of its hour and only used while the hour's size
+// and the file's modification time are as they were when it was read, so
+// the hour still being written is read again once it has grown. Blocks
+// held by a reader stay, the least recently used of the rest are freed
+// once the cache holds more than its size.
+
+#define kBuckets (1024)
+
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cacheLoaded = PTHREAD_COND_INITIALIZER;
+static cache_block_t *buckets[kBuckets];
+static cache_block_t *oldest;
+static cache_block_t *newest;
+static size_t cached; // bytes of the blocks in the cache
+static size_t limit = cache_kDefaultSize;
+
+static cache_block_t **bucketOf(dev_t device, ino_t inode, off_t offset) {
+  uint64_t hash = (uint64_t)device * 0x9e3779b97f4a7c15ULL ^
+                  (uint64_t)inode * 0xff51afd7ed558ccdULL ^ (uint64_t)offset;
+  hash ^= hash >> 29;
+  return &buckets[hash % kBuckets];
+}
+
+static void unlinkRecent(cache_block_t *block) {
+  if (block->older != NULL)
+    block->older->newer = block->newer;
+  else
+    oldest = block->newer;
+  if (block->newer != NULL)
+    block->newer->older = block->older;
+  else
+    newest = block->older;
+  block->older = NULL;
+  block->newer = NULL;
+}
+
+static void linkNewest(cache_block_t *block) {
+  block->older = newest;
+  block->newer = NULL;
+  if (newest != NULL)
+    newest->newer = block;
+  else
+    oldest = block;
+  newest = block;
+}
+
+static void freeBlock(cache_block_t *block) {
+  free(block->records);
+  free(block);
+}
+
+// take a block out of the cache, freeing it unless a reader holds it
+static void dropBlock(cache_block_t *block) {
+  cache_block_t **link = bucketOf(block->device, block->inode, block->offset);
+  while (*link != block)
+    link = &(*link)->next;
+  *link = block->next;
+  unlinkRecent(block);
+  cached -= block->size;
+  block->dropped = true;
+  if (block->refs == 0)
+    freeBlock(block);
+}
+
+// drop the least recently used blocks no reader holds until bytes are left
+static void evict(size_t bytes) {
+  cache_block_t *block = oldest;
+  while ((block != NULL) && (cached > bytes)) {
+    cache_block_t *newer = block->newer;
+    if ((block->refs == 0) && !block->loading)
+      dropBlock(block);
+    block = newer;
+  }
+}
+
+// read the block's bytes from fd and decode them if compressed
+static bool loadBlock(cache_block_t *block, int fd) {
+  unsigned char *data = malloc(block->diskSize);
+  if (data == NULL)
+    return false;
+  size_t bytes = 0;
+  while (bytes < block->diskSize) {
+    ssize_t read = pread(fd, data + bytes, block->diskSize - bytes,
+                         block->offset + bytes);
+    if (read <= 0)
+      break;
+    bytes += read;
+  }
+  if (bytes != block->diskSize) {
+    free(data);
+    return false;
+  }
+  if (codec_isBlock(data, bytes)) {
+    unsigned char *records = malloc(codec_decodedSize(data, bytes) + 1);
+    if (records != NULL)
+      bytes = codec_decode(data, bytes, records);
+    free(data);
+    if (records == NULL)
+      return false;
+    data = records;
+  }
+  block->records = data;
+  block->size = bytes;
+  return true;
+}
+
+// the decoded records of the size bytes at offset of fd, read on the first
+// request and shared until the file changes, NULL when the hour is too big
+// to cache or cannot be read, pass to cache_release when done
+cache_block_t *cache_get(int fd, off_t offset, size_t size) {
+  struct stat sb;
+  if ((size == 0) || (fstat(fd, &sb) < 0))
+    return NULL;
+  pthread_mutex_lock(&cacheLock);
+  if (size > limit / 4) {
+    pthread_mutex_unlock(&cacheLock);
+    return NULL;
+  }
+  cache_block_t **bucket = bucketOf(sb.st_dev, sb.st_ino, offset);
+  cache_block_t *block = *bucket;
+  while ((block != NULL) &&
+         ((block->device != sb.st_dev) || (block->inode != sb.st_ino) ||
+          (block->offset != offset)))
+    block = block->next;
+  if ((block != NULL) && ((block->diskSize != size) ||
+                          (block->modified.tv_sec != sb.st_mtim.tv_sec) ||
+                          (block->modified.tv_nsec != sb.st_mtim.tv_nsec))) {
+    if (block->loading) {
+      // another reader is reading another version, read without the cache
+      pthread_mutex_unlock(&cacheLock);
+      return NULL;
+    }
+    dropBlock(block);
+    block = NULL;
+  }
+  if (block != NULL) {
+    block->refs++;
+    unlinkRecent(block);
+    linkNewest(block);
+    while (block->loading)
+      pthread_cond_wait(&cacheLoaded, &cacheLock);
+    if (block->records == NULL) {
+      // the read failed
+      if (--block->refs == 0)
+        freeBlock(block);
+      block = NULL;
+    }
+    pthread_mutex_unlock(&cacheLock);
+    return block;
+  }
+
+  // first to ask, read it outside the lock while later readers wait
+  block = calloc(1, sizeof(cache_block_t));
+  if (block == NULL) {
+    pthread_mutex_unlock(&cacheLock);
+    return NULL;
+  }
+  block->device = sb.st_dev;
+  block->inode = sb.st_ino;
+  block->offset = offset;
+  block->diskSize = size;
+  block->modified = sb.st_mtim;
+  block->refs = 1;
+  block->loading = true;
+  block->next = *bucket;
+  *bucket = block;
+  linkNewest(block);
+  pthread_mutex_unlock(&cacheLock);
+
+  bool loaded = loadBlock(block, fd);
+
+  pthread_mutex_lock(&cacheLock);
+  block->loading = false;
+  if (loaded) {
+    cached += block->size;
+    evict(limit);
+  } else {
+    dropBlock(block);
+    if (--block->refs == 0)
+      freeBlock(block);
+    block = NULL;
+  }
+  pthread_cond_broadcast(&cacheLoaded);
+  pthread_mutex_unlock(&cacheLock);
+  return block;
+}
+
+// hand back a block from cache_get
+void cache_release(cache_block_t *block) {
+  if (block == NULL)
+    return;
+  pthread_mutex_lock(&cacheLock);
+  if ((--block->refs == 0) && block->dropped)
+    freeBlock(block);
+  else if (block->refs == 0)
+    evict(limit);
+  pthread_mutex_unlock(&cacheLock);
+}
+
+// keep at most bytes of blocks no reader holds, hours larger than a
+// quarter of that are not cached, none are when 0
+void cache_setSize(size_t bytes) {
+  pthread_mutex_lock(&cacheLock);
+  limit = bytes;
+  evict(limit);
+  pthread_mutex_unlock(&cacheLock);
+}
+
+// free every block no reader holds
+void cache_trim(void) {
+  pthread_mutex_lock(&cacheLock);
+  evict(0);
+  pthread_mutex_unlock(&cacheLock);
+}
@@ -0,0 +1,35 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+// bytes of decoded hours kept when log_setCacheSize has not been called
+#define cache_kDefaultSize (64 * 1048576)
+
+// the records of one hour, decoded, shared by every reader holding it
+typedef struct cache_block_s {
+  struct cache_block_s *next;  // in its hash chain
+  struct cache_block_s *older; // least recently used order
+  struct cache_block_s *newer;
+  // the hour's bytes in a file, and the file as it was when they were read
+  dev_t device;
+  ino_t inode;
+  off_t offset;
+  size_t diskSize;
+  struct timespec modified;
+  int refs;
+  bool loading; // being read by the first reader to ask for it
+  bool dropped; // out of the cache, freed with the last reference
+  unsigned char *records;
+  size_t size;
+} cache_block_t;
+
+cache_block_t *cache_get(int fd, off_t offset, size_t size);
+void cache_release(cache_block_t *block);
+void cache_setSize(size_t bytes);
+void cache_trim(void);
+
+#endif // CACHE_H
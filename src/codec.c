@@ -0,0 +1,240 @@
+#include <netinet/in.h>
+#include <string.h>
+
+#include "codec.h"
+
+// A compressed hour file is a sequence of blocks, one per buffer written.
+// Each block has a header of six big endian words, magic, version, record
+// size, record count and the byte lengths of its two streams. The time
+// stream holds the delta of delta of each millis from hour as a zigzag
+// varint. The data stream holds, for each record, a bit mask of the 32 bit
+// words (and trailing bytes) that differ from the previous record followed
+// by those words XORed with the previous record. The magic is far above
+// any millis from hour, but a legacy file of micros from hour may start
+// with it, so data is only taken as a block when the rest of its header
+// agrees: the version, a record size and stream lengths that fit the
+// record count and the bytes that follow.
+
+#define kMagic (0x41434C42) // "ACLB"
+#define kHeaderWords (6)
+#define kHeaderSize (codec_kHeaderSize)
+
+static inline unsigned char *putVarint(unsigned char *out, uint64_t value) {
+  while (value >= 0x80) {
+    *out++ = (unsigned char)(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = (unsigned char)value;
+  return out;
+}
+
+static inline const unsigned char *getVarint(const unsigned char *in,
+                                             const unsigned char *end,
+                                             uint64_t *value) {
+  uint64_t result = 0;
+  int shift = 0;
+  while ((in < end) && (shift < 64)) {
+    unsigned char byte = *in++;
+    result |= (uint64_t)(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      *value = result;
+      return in;
+    }
+    shift += 7;
+  }
+  return NULL;
+}
+
+// header of the block at data, false when it is missing, truncated or
+// not that of a block codec_encode could have written
+static bool getHeader(const unsigned char *data, size_t size,
+                      uint32_t *header) {
+  if (size < kHeaderSize)
+    return false;
+  memcpy(header, data, kHeaderSize);
+  int word;
+  for (word = 0; word < kHeaderWords; word++)
+    header[word] = ntohl(header[word]);
+  if ((header[0] != kMagic) || (header[1] != codec_kVersion) ||
+      (header[2] <= sizeof(uint32_t)) ||
+      ((uint64_t)header[4] + header[5] > size - kHeaderSize))
+    return false;
+  // each time a varint of 1 to 10 bytes, each record's data a mask and at
+  // most every byte of the data
+  uint64_t count = header[3];
+  uint64_t dataSize = header[2] - sizeof(uint32_t);
+  uint64_t maskSize = ((dataSize + 3) / 4 + 7) / 8;
+  return (header[4] >= count) && (header[4] <= 10 * count) &&
+         (header[5] >= count * maskSize) &&
+         (header[5] <= count * (maskSize + dataSize));
+}
+
+// true when data starts with a block, data holding its first
+// codec_kHeaderSize bytes, or all size bytes when fewer, of size bytes
+bool codec_isBlock(const unsigned char *data, size_t size) {
+  uint32_t header[kHeaderWords];
+  return getHeader(data, size, header);
+}
+
+// largest block codec_encode can produce for size bytes of records
+int codec_bound(int size, int recordSize) {
+  int count = size / recordSize;
+  int dataSize = recordSize - sizeof(uint32_t);
+  int slots = (dataSize + 3) / 4;
+  return kHeaderSize + count * (5 + (slots + 7) / 8 + dataSize);
+}
+
+// encode legacy records (big endian millis from hour then data) as a block,
+// returns the block size
+int codec_encode(const unsigned char *records, int size, int recordSize,
+                 unsigned char *block) {
+  int count = size / recordSize;
+  int dataSize = recordSize - sizeof(uint32_t);
+  int words = dataSize / 4;
+  int tail = dataSize % 4;
+  int maskSize = (words + (tail ? 1 : 0) + 7) / 8;
+
+  unsigned char *out = block + kHeaderSize;
+  int64_t previous = 0, previousDelta = 0;
+  int index;
+  for (index = 0; index < count; index++) {
+    int64_t millis = ntohl(*(const uint32_t *)&records[index * recordSize]);
+    int64_t delta = millis - previous;
+    int64_t deltaOfDelta = delta - previousDelta;
+    out = putVarint(out, ((uint64_t)deltaOfDelta << 1) ^
+                             (uint64_t)(deltaOfDelta >> 63)); // zigzag
+    previous = millis;
+    previousDelta = delta;
+  }
+  uint32_t timeBytes = out - (block + kHeaderSize);
+
+  static const unsigned char zero[4] = {0};
+  const unsigned char *last = NULL;
+  for (index = 0; index < count; index++) {
+    const unsigned char *data =
+        &records[index * recordSize] + sizeof(uint32_t);
+    unsigned char *mask = out;
+    memset(mask, 0, maskSize);
+    out += maskSize;
+    int word;
+    for (word = 0; word < words; word++) {
+      uint32_t current, before = 0;
+      memcpy(&current, &data[word * 4], 4);
+      if (last != NULL)
+        memcpy(&before, &last[word * 4], 4);
+      current ^= before;
+      if (current != 0) {
+        mask[word >> 3] |= 1 << (word & 7);
+        memcpy(out, &current, 4);
+        out += 4;
+      }
+    }
+    if (tail) {
+      const unsigned char *before = last ? &last[words * 4] : zero;
+      unsigned char difference = 0;
+      int byte;
+      for (byte = 0; byte < tail; byte++)
+        difference |= data[words * 4 + byte] ^ before[byte];
+      if (difference != 0) {
+        mask[words >> 3] |= 1 << (words & 7);
+        for (byte = 0; byte < tail; byte++)
+          *out++ = data[words * 4 + byte] ^ before[byte];
+      }
+    }
+    last = data;
+  }
+
+  uint32_t *header = (uint32_t *)block;
+  header[0] = htonl(kMagic);
+  header[1] = htonl(codec_kVersion);
+  header[2] = htonl(recordSize);
+  header[3] = htonl(count);
+  header[4] = htonl(timeBytes);
+  header[5] = htonl(out - (block + kHeaderSize) - timeBytes);
+  return out - block;
+}
+
+// bytes of legacy records the blocks in data decode to
+size_t codec_decodedSize(const unsigned char *data, size_t size) {
+  size_t decoded = 0;
+  uint32_t header[kHeaderWords];
+  while (getHeader(data, size, header)) {
+    decoded += (size_t)header[2] * header[3];
+    size_t blockSize = kHeaderSize + header[4] + header[5];
+    data += blockSize;
+    size -= blockSize;
+  }
+  return decoded;
+}
+
+// decode the blocks in data to legacy records, records must hold
+// codec_decodedSize bytes, a damaged or truncated block ends the decode,
+// returns the bytes decoded
+size_t codec_decode(const unsigned char *data, size_t size,
+                    unsigned char *records) {
+  unsigned char *out = records;
+  uint32_t header[kHeaderWords];
+  while (getHeader(data, size, header)) {
+    int recordSize = header[2];
+    uint32_t count = header[3];
+    int dataSize = recordSize - sizeof(uint32_t);
+    int words = dataSize / 4;
+    int tail = dataSize % 4;
+    int maskSize = (words + (tail ? 1 : 0) + 7) / 8;
+
+    const unsigned char *in = data + kHeaderSize;
+    const unsigned char *timeEnd = in + header[4];
+    int64_t previous = 0, previousDelta = 0;
+    uint32_t index;
+    for (index = 0; index < count; index++) {
+      uint64_t zigzag;
+      in = getVarint(in, timeEnd, &zigzag);
+      if (in == NULL)
+        return out - records;
+      previousDelta += (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+      previous += previousDelta;
+      *(uint32_t *)&out[index * recordSize] = htonl((uint32_t)previous);
+    }
+
+    const unsigned char *dataEnd = timeEnd + header[5];
+    in = timeEnd;
+    const unsigned char *last = NULL;
+    for (index = 0; index < count; index++) {
+      unsigned char *record = &out[index * recordSize] + sizeof(uint32_t);
+      const unsigned char *mask = in;
+      in += maskSize;
+      if (in > dataEnd)
+        return out - records;
+      if (last != NULL)
+        memcpy(record, last, dataSize);
+      else
+        memset(record, 0, dataSize);
+      int word;
+      for (word = 0; word < words; word++) {
+        if (mask[word >> 3] & (1 << (word & 7))) {
+          if (in + 4 > dataEnd)
+            return out - records;
+          uint32_t current, difference;
+          memcpy(&current, &record[word * 4], 4);
+          memcpy(&difference, in, 4);
+          current ^= difference;
+          memcpy(&record[word * 4], &current, 4);
+          in += 4;
+        }
+      }
+      if (tail && (mask[words >> 3] & (1 << (words & 7)))) {
+        if (in + tail > dataEnd)
+          return out - records;
+        int byte;
+        for (byte = 0; byte < tail; byte++)
+          record[words * 4 + byte] ^= *in++;
+      }
+      last = record;
+    }
+    out += (size_t)recordSize * count;
+    size_t blockSize = kHeaderSize + header[4] + header[5];
+    data += blockSize;
+    size -= blockSize;
+  }
+  return out - records;
+}
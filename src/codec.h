@@ -0,0 +1,22 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// block format version written by codec_encode
+#define codec_kVersion (1)
+
+// bytes of the header leading each block
+#define codec_kHeaderSize (6 * 4)
+
+bool codec_isBlock(const unsigned char *data, size_t size);
+int codec_bound(int size, int recordSize);
+int codec_encode(const unsigned char *records, int size, int recordSize,
+                 unsigned char *block);
+size_t codec_decodedSize(const unsigned char *data, size_t size);
+size_t codec_decode(const unsigned char *data, size_t size,
+                    unsigned char *records);
+
+#endif // CODEC_H
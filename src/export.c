@@ -0,0 +1,290 @@
+#include <math.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+// Timeseries export as {"sources":[...],"timeseries":[[ms,v1,v2...],...]}
+// or as CSV with a millis column then one column per source. Times are
+// epoch millis whatever the resolution, those of a logger of micros
+// resolution with a fraction when not whole. Records with the same
+// timestamp share a row, sources missing from a row are null (empty in
+// CSV). Text is formatted without allocation into a large buffer written
+// out in chunks.
+
+#define kTextSize (65536)
+#define kRowSpace (log_kMaxQuerySources * 32 + 64) // longest row text
+
+typedef struct {
+  FILE *out;
+  log_format_t format;
+  log_type_t type;
+  int valueSize; // bytes of type
+  bool sourced;
+  const uint32_t *sources;
+  int columns;
+  int unitsPerMilli;  // of record times
+  uint64_t rowTime;   // epoch time of the row, in those units
+  uint32_t present; // bit n set when column n has a value in the row
+  unsigned char values[log_kMaxQuerySources][sizeof(double)];
+  long rows;
+  int length;
+  char text[kTextSize];
+} exporter_t;
+
+static void flushText(exporter_t *exporter) {
+  fwrite(exporter->text, 1, exporter->length, exporter->out);
+  exporter->length = 0;
+}
+
+static inline void putText(exporter_t *exporter, const char *text) {
+  while (*text)
+    exporter->text[exporter->length++] = *text++;
+}
+
+static inline void putUnsigned(exporter_t *exporter, uint64_t value) {
+  char digits[20];
+  int count = 0;
+  do {
+    digits[count++] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+  while (count)
+    exporter->text[exporter->length++] = digits[--count];
+}
+
+static inline void putSigned(exporter_t *exporter, int64_t value) {
+  if (value < 0) {
+    exporter->text[exporter->length++] = '-';
+    putUnsigned(exporter, (uint64_t)0 - (uint64_t)value);
+  } else {
+    putUnsigned(exporter, (uint64_t)value);
+  }
+}
+
+// fixed point with up to decimals digits after the point, trailing zeros
+// dropped, falls back to printf only for very large magnitudes
+static void putReal(exporter_t *exporter, double value, int decimals) {
+  if (!isfinite(value)) {
+    putText(exporter, exporter->format == log_kJson ? "null" : "");
+    return;
+  }
+  if (fabs(value) >= 1e15) {
+    exporter->length += snprintf(&exporter->text[exporter->length], 32,
+                                 "%.17g", value);
+    return;
+  }
+  static const uint64_t scales[] = {1LL,         10LL,        100LL,
+                                    1000LL,      10000LL,     100000LL,
+                                    1000000LL,   10000000LL,  100000000LL,
+                                    1000000000LL};
+  uint64_t scale = scales[decimals];
+  if (value < 0) {
+    exporter->text[exporter->length++] = '-';
+    value = -value;
+  }
+  uint64_t whole = (uint64_t)value;
+  uint64_t fraction = (uint64_t)llround((value - (double)whole) * scale);
+  if (fraction >= scale) {
+    whole++;
+    fraction -= scale;
+  }
+  putUnsigned(exporter, whole);
+  if (fraction != 0) {
+    while (fraction % 10 == 0) {
+      fraction /= 10;
+      decimals--;
+    }
+    char digits[10];
+    int count;
+    for (count = 0; count < decimals; count++) {
+      digits[decimals - 1 - count] = '0' + fraction % 10;
+      fraction /= 10;
+    }
+    exporter->text[exporter->length++] = '.';
+    memcpy(&exporter->text[exporter->length], digits, decimals);
+    exporter->length += decimals;
+  }
+}
+
+static void putValue(exporter_t *exporter, const unsigned char *value) {
+  switch (exporter->type) {
+  case log_kInt16: {
+    int16_t number;
+    memcpy(&number, value, sizeof(number));
+    putSigned(exporter, number);
+    break;
+  }
+  case log_kUint16: {
+    uint16_t number;
+    memcpy(&number, value, sizeof(number));
+    putUnsigned(exporter, number);
+    break;
+  }
+  case log_kInt32: {
+    int32_t number;
+    memcpy(&number, value, sizeof(number));
+    putSigned(exporter, number);
+    break;
+  }
+  case log_kUint32: {
+    uint32_t number;
+    memcpy(&number, value, sizeof(number));
+    putUnsigned(exporter, number);
+    break;
+  }
+  case log_kFloat: {
+    float number;
+    memcpy(&number, value, sizeof(number));
+    putReal(exporter, number, 6);
+    break;
+  }
+  case log_kDouble: {
+    double number;
+    memcpy(&number, value, sizeof(number));
+    putReal(exporter, number, 9);
+    break;
+  }
+  }
+}
+
+// epoch time in units of unitsPerMilli as millis, with up to three
+// decimals
+static void putMillis(exporter_t *exporter, uint64_t time) {
+  putUnsigned(exporter, time / exporter->unitsPerMilli);
+  uint32_t fraction = time % exporter->unitsPerMilli;
+  if (fraction == 0)
+    return;
+  int decimals = 3;
+  while (fraction % 10 == 0) {
+    fraction /= 10;
+    decimals--;
+  }
+  exporter->text[exporter->length++] = '.';
+  int digit;
+  for (digit = decimals - 1; digit >= 0; digit--) {
+    exporter->text[exporter->length + digit] = '0' + fraction % 10;
+    fraction /= 10;
+  }
+  exporter->length += decimals;
+}
+
+static void putRow(exporter_t *exporter) {
+  if (exporter->present == 0)
+    return;
+  if (exporter->length > kTextSize - kRowSpace)
+    flushText(exporter);
+  bool json = exporter->format == log_kJson;
+  if (json)
+    putText(exporter, exporter->rows ? ",[" : "[");
+  putMillis(exporter, exporter->rowTime);
+  int column;
+  for (column = 0; column < exporter->columns; column++) {
+    exporter->text[exporter->length++] = ',';
+    if (exporter->present & (1UL << column))
+      putValue(exporter, exporter->values[column]);
+    else if (json)
+      putText(exporter, "null");
+  }
+  putText(exporter, json ? "]" : "\n");
+  exporter->present = 0;
+  exporter->rows++;
+}
+
+static bool exportBlock(const log_block_t *block, void *context) {
+  exporter_t *exporter = (exporter_t *)context;
+  uint64_t hourTime = (uint64_t)block->hour * 1000LL * block->unitsPerMilli;
+  int valueOffset = sizeof(uint32_t);
+  if (exporter->sourced)
+    valueOffset += log_kSourceSize;
+  int column = 0;
+  int index;
+  for (index = 0; index < block->count; index++) {
+    const unsigned char *record = &block->records[index * block->recordSize];
+    if (exporter->sourced) {
+      uint32_t source = ntohl(*(const uint32_t *)(record + sizeof(uint32_t)));
+      if (exporter->sources[column] != source) {
+        for (column = 0; column < exporter->columns; column++) {
+          if (exporter->sources[column] == source)
+            break;
+        }
+        if (column == exporter->columns) {
+          column = 0;
+          continue; // not exported
+        }
+      }
+    }
+    uint64_t time = hourTime + ntohl(*(const uint32_t *)record);
+    if (time != exporter->rowTime) {
+      putRow(exporter);
+      exporter->rowTime = time;
+    }
+    memcpy(exporter->values[column], record + valueOffset,
+           exporter->valueSize);
+    exporter->present |= 1UL << column;
+  }
+  return true;
+}
+
+// export the value at the start of each record's data, of the count
+// sources (one value column when the logger does not use sources), logged
+// in [start, end), returns the rows written, -1 when the data is too short
+// to hold type
+long log_export(log_t *logger, const uint32_t *sources, int count,
+                log_type_t type, uint64_t start, uint64_t end,
+                log_format_t format, FILE *out) {
+  static const uint32_t anySource = 0;
+  static const int sizes[] = {[log_kInt16] = 2,  [log_kUint16] = 2,
+                              [log_kInt32] = 4,  [log_kUint32] = 4,
+                              [log_kFloat] = 4,  [log_kDouble] = 8};
+  if ((count < 0) || (count > log_kMaxQuerySources) || logger->variable ||
+      ((unsigned)type > log_kDouble) || (sizes[type] > logger->dataSize))
+    return -1;
+  exporter_t *exporter = malloc(sizeof(exporter_t));
+  if (exporter == NULL)
+    return -1;
+  exporter->out = out;
+  exporter->format = format;
+  exporter->type = type;
+  exporter->valueSize = sizes[type];
+  exporter->sourced = logger->sourced;
+  exporter->sources = logger->sourced ? sources : &anySource;
+  exporter->columns = logger->sourced ? count : 1;
+  exporter->unitsPerMilli = logger->resolution == log_kMicros ? 1000 : 1;
+  exporter->rowTime = 0;
+  exporter->present = 0;
+  exporter->rows = 0;
+  exporter->length = 0;
+
+  int column;
+  if (format == log_kJson) {
+    putText(exporter, "{\"sources\":[");
+    for (column = 0; logger->sourced && (column < count); column++) {
+      if (column)
+        putText(exporter, ",");
+      putUnsigned(exporter, sources[column]);
+    }
+    putText(exporter, "],\"timeseries\":[");
+  } else {
+    putText(exporter, "millis");
+    for (column = 0; column < exporter->columns; column++) {
+      putText(exporter, ",");
+      if (logger->sourced)
+        putUnsigned(exporter, sources[column]);
+      else
+        putText(exporter, "value");
+    }
+    putText(exporter, "\n");
+  }
+  if (exporter->columns != 0)
+    log_query(logger, start, end, exportBlock, exporter);
+  putRow(exporter);
+  if (format == log_kJson)
+    putText(exporter, "]}");
+  flushText(exporter);
+  long rows = exporter->rows;
+  free(exporter);
+  return rows;
+}
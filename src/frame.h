@@ -0,0 +1,47 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A record of a logger opened with variable set is framed as the big
+// endian millis from the hour, as fixed size records are, then the size of
+// its data as a LEB128 varint, then the data.
+
+// most bytes before the data of a frame
+#define frame_kMaxHeader (4 + 5)
+
+// write size as a varint at at, returns the bytes written
+static inline int frame_putSize(unsigned char *at, uint32_t size) {
+  int bytes = 0;
+  while (size >= 0x80) {
+    at[bytes++] = (unsigned char)(size | 0x80);
+    size >>= 7;
+  }
+  at[bytes++] = (unsigned char)size;
+  return bytes;
+}
+
+// bytes of the frame at record, with available bytes left from it, the
+// data being the last size of them, 0 when it is cut short or malformed
+static inline size_t frame_size(const unsigned char *record, size_t available,
+                                uint32_t *size) {
+  size_t at = sizeof(uint32_t);
+  uint32_t value = 0;
+  int shift = 0;
+  while (true) {
+    if ((at >= available) || (shift > 28))
+      return 0;
+    unsigned char byte = record[at++];
+    value |= (uint32_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0)
+      break;
+    shift += 7;
+  }
+  if (available - at < value)
+    return 0;
+  *size = value;
+  return at + value;
+}
+
+#endif // FRAME_H
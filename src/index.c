@@ -0,0 +1,298 @@
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "codec.h"
+#include "frame.h"
+#include "index.h"
+
+// Each hour file HH.dat gets a sidecar HH.idx holding a header of magic,
+// record count, first / last millis and the size of the data file they
+// summarise, followed by a sparse entry of millis and record stream offset
+// for every index_kInterval records. The day directory holds day.idx, the
+// count, first, last and size of each of its 24 hours, so coverage can be
+// found without opening any data file. All values are big endian like the
+// record timestamps.
+// The offsets of variable size frames (a record size of 0, see frame.h)
+// are those of their first byte.
+
+#define kMagic (0x41434959) // "ACIY", "ACIX" indexes had no size
+#define kHeaderWords (5)
+#define kHeaderSize (kHeaderWords * sizeof(uint32_t))
+#define kEntrySize (2 * sizeof(uint32_t))
+#define kStagedEntries (256)
+#define kChunkSize (65536)
+
+typedef struct {
+  int fd;
+  index_hour_t summary;
+  int stagedFirst; // entry number of staged[0]
+  int stagedCount;
+  uint32_t staged[kStagedEntries * 2];
+} indexWriter_t;
+
+static void flushEntries(indexWriter_t *writer) {
+  if (writer->stagedCount == 0)
+    return;
+  pwrite(writer->fd, writer->staged, writer->stagedCount * kEntrySize,
+         kHeaderSize + (off_t)writer->stagedFirst * kEntrySize);
+  writer->stagedCount = 0;
+}
+
+// index the records of size bytes which start offset bytes into the hour's
+// record stream
+static void indexRecords(indexWriter_t *writer, const unsigned char *records,
+                         int size, int recordSize, uint32_t offset) {
+  int index = 0;
+  while (index < size) {
+    int bytes = recordSize;
+    uint32_t dataSize;
+    if (recordSize == 0)
+      bytes = (int)frame_size(&records[index], size - index, &dataSize);
+    else if (index + recordSize > size)
+      break;
+    if (bytes == 0)
+      break;
+    uint32_t millis = ntohl(*(uint32_t *)&records[index]);
+    uint32_t count = writer->summary.count;
+    if (count % index_kInterval == 0) {
+      if (writer->stagedCount == kStagedEntries)
+        flushEntries(writer);
+      if (writer->stagedCount == 0)
+        writer->stagedFirst = count / index_kInterval;
+      writer->staged[writer->stagedCount * 2] = htonl(millis);
+      writer->staged[writer->stagedCount * 2 + 1] =
+          htonl(offset + (uint32_t)index);
+      writer->stagedCount++;
+    }
+    if (count == 0)
+      writer->summary.first = millis;
+    writer->summary.last = millis;
+    writer->summary.count = count + 1;
+    index += bytes;
+  }
+}
+
+// index the whole data file, for hours written before indexing existed
+static void indexDataFile(indexWriter_t *writer, const char *dataPath,
+                          int recordSize) {
+  int fd = open(dataPath, O_RDONLY);
+  if (fd < 0)
+    return;
+  unsigned char header[codec_kHeaderSize];
+  struct stat sb;
+  if ((recordSize == 0) && (fstat(fd, &sb) == 0) && (sb.st_size > 0)) {
+    // frames span chunks, index the whole file at once
+    void *data = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+      return;
+    indexRecords(writer, data, (int)sb.st_size, recordSize, 0);
+    munmap(data, sb.st_size);
+    return;
+  }
+  if ((recordSize != 0) && (fstat(fd, &sb) == 0) &&
+      (pread(fd, header, sizeof(header), 0) == sizeof(header)) &&
+      codec_isBlock(header, sb.st_size)) {
+    // compressed, index the decoded records
+    void *data = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+      return;
+    size_t size = codec_decodedSize(data, sb.st_size);
+    unsigned char *records = malloc(size);
+    if (records != NULL) {
+      indexRecords(writer, records, codec_decode(data, sb.st_size, records),
+                   recordSize, 0);
+      free(records);
+    }
+    munmap(data, sb.st_size);
+    return;
+  }
+  unsigned char chunk[kChunkSize];
+  int chunkSize = recordSize != 0 ? kChunkSize - kChunkSize % recordSize : 0;
+  uint32_t offset = 0;
+  ssize_t bytes;
+  while ((bytes = read(fd, chunk, chunkSize)) > 0) {
+    indexRecords(writer, chunk, (int)bytes, recordSize, offset);
+    offset += (uint32_t)bytes;
+  }
+  close(fd);
+}
+
+// open the index of directory/HH.dat
+static int openHour(const char *directory, int hour) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/%2.2u.idx", directory, hour);
+  return open(path, O_RDWR | O_CREAT, 0666);
+}
+
+// append records, offset bytes into the hour's record stream, to the open
+// index fd of directory/HH.dat, now bytes long, indexing the whole data
+// file when there is no index yet
+static bool indexHour(int fd, const char *directory, int hour,
+                      const unsigned char *records, int size, int recordSize,
+                      uint32_t offset, uint32_t bytes, uint32_t *header) {
+  char path[4096];
+  indexWriter_t writer;
+  writer.fd = fd;
+  writer.stagedCount = 0;
+  // an index behind its data file, as after a crash between a write and
+  // its update, is rebuilt
+  if ((pread(writer.fd, header, kHeaderSize, 0) == kHeaderSize) &&
+      (ntohl(header[0]) == kMagic) &&
+      ((recordSize != 0 ? ntohl(header[1]) * (uint32_t)recordSize
+                        : ntohl(header[4])) == offset)) {
+    writer.summary.count = ntohl(header[1]);
+    writer.summary.first = ntohl(header[2]);
+    writer.summary.last = ntohl(header[3]);
+    indexRecords(&writer, records, size, recordSize, offset);
+  } else {
+    // the data file already holds these records and any written before
+    memset(&writer.summary, 0, sizeof(writer.summary));
+    snprintf(path, sizeof(path), "%s/%2.2u.dat", directory, hour);
+    indexDataFile(&writer, path, recordSize);
+  }
+  flushEntries(&writer);
+  header[0] = htonl(kMagic);
+  header[1] = htonl(writer.summary.count);
+  header[2] = htonl(writer.summary.first);
+  header[3] = htonl(writer.summary.last);
+  header[4] = htonl(bytes);
+  return pwrite(writer.fd, header, kHeaderSize, 0) == kHeaderSize;
+}
+
+// open the day manifest, indexing hours logged before indexing existed
+// when it is new
+static int openDay(const char *directory, int hour, int recordSize) {
+  char path[4096];
+  uint32_t header[kHeaderWords];
+  snprintf(path, sizeof(path), "%s/day.idx", directory);
+  int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0666);
+  if (fd < 0)
+    return open(path, O_WRONLY);
+  int other;
+  for (other = 0; other < 24; other++) {
+    snprintf(path, sizeof(path), "%s/%2.2u.dat", directory, other);
+    struct stat sb;
+    if ((other == hour) || (stat(path, &sb) != 0))
+      continue;
+    int hourFd = openHour(directory, other);
+    if (hourFd < 0)
+      continue;
+    if (indexHour(hourFd, directory, other, NULL, 0, recordSize, 0,
+                  (uint32_t)sb.st_size, header))
+      pwrite(fd, &header[1], sizeof(index_hour_t),
+             other * sizeof(index_hour_t));
+    close(hourFd);
+  }
+  return fd;
+}
+
+// update the hour index and day manifest after records have been appended
+// to directory/HH.dat, offset bytes into its record stream, leaving it
+// bytes long, fds holds the manifest and hour index descriptors (-1 when
+// closed) which stay open for the next append to the same hour, recordSize
+// is 0 for variable frames
+bool index_append(int *fds, const char *directory, int hour,
+                  const unsigned char *records, int size, int recordSize,
+                  uint32_t offset, uint32_t bytes) {
+  uint32_t header[kHeaderWords];
+  if (fds[0] < 0)
+    fds[0] = openDay(directory, hour, recordSize);
+  if ((fds[0] >= 0) && (fds[1] < 0))
+    fds[1] = openHour(directory, hour);
+  if (fds[1] < 0)
+    return false;
+  return indexHour(fds[1], directory, hour, records, size, recordSize, offset,
+                   bytes, header) &&
+         (pwrite(fds[0], &header[1], sizeof(index_hour_t),
+                 hour * sizeof(index_hour_t)) == sizeof(index_hour_t));
+}
+
+// after a failed index_append, clear the hour's summary in the manifest
+// and remove its index, so readers take the hour from its data file until
+// the next append indexes it afresh
+void index_forget(int *fds, const char *directory, int hour) {
+  char path[4096];
+  index_hour_t unknown = {0, 0, 0, 0};
+  index_close(fds);
+  snprintf(path, sizeof(path), "%s/day.idx", directory);
+  int fd = open(path, O_WRONLY);
+  if (fd >= 0) {
+    pwrite(fd, &unknown, sizeof(unknown), hour * sizeof(index_hour_t));
+    close(fd);
+  }
+  snprintf(path, sizeof(path), "%s/%2.2u.idx", directory, hour);
+  unlink(path);
+}
+
+// close the descriptors kept by index_append, on a change of hour
+void index_close(int *fds) {
+  int fd;
+  for (fd = 0; fd < 2; fd++) {
+    if (fds[fd] >= 0)
+      close(fds[fd]);
+    fds[fd] = -1;
+  }
+}
+
+// read the summaries of the 24 hours of a day, false when the day has no
+// manifest, hours without data have a zero count
+bool index_day(const char *directory, index_hour_t *hours) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/day.idx", directory);
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  uint32_t entries[24 * 4] = {0};
+  ssize_t bytes = pread(fd, entries, sizeof(entries), 0);
+  close(fd);
+  if (bytes < 0)
+    return false;
+  int hour;
+  for (hour = 0; hour < 24; hour++) {
+    hours[hour].count = ntohl(entries[hour * 4]);
+    hours[hour].first = ntohl(entries[hour * 4 + 1]);
+    hours[hour].last = ntohl(entries[hour * 4 + 2]);
+    hours[hour].bytes = ntohl(entries[hour * 4 + 3]);
+  }
+  return true;
+}
+
+// read the sparse entries of directory/HH.idx as count pairs of millis and
+// record stream offset, NULL when the hour has no index, free when done
+uint32_t *index_entries(const char *directory, int hour, int *count) {
+  char path[4096];
+  uint32_t header[kHeaderWords];
+  snprintf(path, sizeof(path), "%s/%2.2u.idx", directory, hour);
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  uint32_t *entries = NULL;
+  if ((pread(fd, header, kHeaderSize, 0) == kHeaderSize) &&
+      (ntohl(header[0]) == kMagic)) {
+    uint32_t wanted = (ntohl(header[1]) + index_kInterval - 1) /
+                      index_kInterval;
+    entries = malloc(wanted * kEntrySize + 1);
+    ssize_t bytes = -1;
+    if (entries != NULL)
+      bytes = pread(fd, entries, wanted * kEntrySize, kHeaderSize);
+    if (bytes < 0) {
+      free(entries);
+      entries = NULL;
+    } else {
+      *count = (int)(bytes / kEntrySize);
+      int entry;
+      for (entry = 0; entry < *count * 2; entry++)
+        entries[entry] = ntohl(entries[entry]);
+    }
+  }
+  close(fd);
+  return entries;
+}
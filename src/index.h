@@ -0,0 +1,26 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// records between sparse index entries
+#define index_kInterval (256)
+
+// summary of one hour file, millis are from the start of the hour
+typedef struct {
+  uint32_t count;
+  uint32_t first;
+  uint32_t last;
+  uint32_t bytes; // of the hour file summarised, 0 when not noted
+} index_hour_t;
+
+bool index_append(int *fds, const char *directory, int hour,
+                  const unsigned char *records, int size, int recordSize,
+                  uint32_t offset, uint32_t bytes);
+void index_forget(int *fds, const char *directory, int hour);
+void index_close(int *fds);
+bool index_day(const char *directory, index_hour_t *hours);
+uint32_t *index_entries(const char *directory, int hour, int *count);
+
+#endif // INDEX_H
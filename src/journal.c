@@ -0,0 +1,83 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "journal.h"
+
+// A journal file holds the write buffers of one logger, each behind a
+// header page recording how many bytes of records it holds and the time
+// they belong to. Records are committed straight into the mapped buffer,
+// so after a crash the next log_open finds them in the file and writes
+// them to their hour file.
+
+#define kMagic (0x41434a4e) // "ACJN"
+
+// bytes of one header and buffer, whole pages
+static size_t bufferStride(int bufferSize) {
+  size_t page = journal_kHeaderSize;
+  return page + ((size_t)bufferSize + page - 1) / page * page;
+}
+
+// map an existing journal, NULL when it is empty or cannot be mapped
+unsigned char *journal_map(int fd, size_t *size) {
+  struct stat sb;
+  if ((fstat(fd, &sb) < 0) || (sb.st_size < journal_kHeaderSize))
+    return NULL;
+  void *journal =
+      mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (journal == MAP_FAILED)
+    return NULL;
+  *size = sb.st_size;
+  return journal;
+}
+
+// find the buffers of a mapped journal, returns how many were found
+int journal_buffers(unsigned char *journal, size_t size,
+                    unsigned char **buffers) {
+  int count = 0;
+  size_t offset = 0;
+  while ((count < journal_kMaxBuffers) &&
+         (offset + journal_kHeaderSize <= size)) {
+    journal_header_t *header = (journal_header_t *)(journal + offset);
+    if ((header->magic != kMagic) || (header->bufferSize <= 0) ||
+        (offset + bufferStride(header->bufferSize) > size) ||
+        (header->size < 0) || (header->size > header->bufferSize))
+      break;
+    buffers[count++] = journal + offset + journal_kHeaderSize;
+    offset += bufferStride(header->bufferSize);
+  }
+  return count;
+}
+
+// force the header of buffer and its first size bytes of records out to
+// the device
+void journal_sync(unsigned char *buffer, int size) {
+  size_t page = journal_kHeaderSize;
+  msync(buffer - page, page + ((size_t)size + page - 1) / page * page,
+        MS_SYNC);
+}
+
+// size the journal for count empty buffers and map it, NULL on failure
+unsigned char *journal_create(int fd, int bufferSize, int recordSize,
+                              int count, size_t *size) {
+  size_t stride = bufferStride(bufferSize);
+  if ((ftruncate(fd, 0) < 0) || (ftruncate(fd, stride * count) < 0))
+    return NULL;
+  unsigned char *journal = mmap(NULL, stride * count, PROT_READ | PROT_WRITE,
+                                MAP_SHARED, fd, 0);
+  if (journal == MAP_FAILED)
+    return NULL;
+  int index;
+  for (index = 0; index < count; index++) {
+    journal_header_t *header = (journal_header_t *)(journal + index * stride);
+    header->recordSize = recordSize;
+    header->bufferSize = bufferSize;
+    header->size = 0;
+    header->fileTime = 0;
+    header->flushOffset = 0;
+    header->magic = kMagic;
+  }
+  msync(journal, stride * count, MS_SYNC);
+  *size = stride * count;
+  return journal;
+}
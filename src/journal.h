@@ -0,0 +1,34 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// bytes ahead of each journal buffer, one page so buffers stay aligned
+#define journal_kHeaderSize (4096)
+
+// maximum buffers in one journal, the write buffer and the async spare
+#define journal_kMaxBuffers (2)
+
+// state of one journal buffer, host byte order
+typedef struct {
+  uint32_t magic;
+  uint32_t recordSize;
+  int32_t bufferSize;
+  int32_t size;        // bytes of records committed to the buffer
+  int64_t fileTime;    // time of the buffered records
+  int64_t flushOffset; // hour file size + 1 while the buffer is written out
+} journal_header_t;
+
+static inline journal_header_t *journal_header(unsigned char *buffer) {
+  return (journal_header_t *)(buffer - journal_kHeaderSize);
+}
+
+unsigned char *journal_map(int fd, size_t *size);
+int journal_buffers(unsigned char *journal, size_t size,
+                    unsigned char **buffers);
+void journal_sync(unsigned char *buffer, int size);
+unsigned char *journal_create(int fd, int bufferSize, int recordSize,
+                              int count, size_t *size);
+
+#endif // JOURNAL_H
@@ -0,0 +1,218 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "live.h"
+
+// A live ring is a POSIX shared memory object named after the real path of
+// a log tree, holding the records most recently committed by its writer so
+// readers in any process can tail them before they reach an hour file.
+// Each slot is the record's epoch time then its data, in 8 byte words.
+// The one writer fills the slot at head and then publishes it by storing
+// head + 1, overwriting the oldest slot once the ring is full. Readers copy
+// a slot and then check head again, the copy is good when the writer had
+// not yet started on the slot that replaces it. Readers sleep on a futex
+// on the low word of head, woken by the writer only when one is waiting.
+
+#define kMagic (0x41434c56) // "ACLV"
+#define kHeaderSize (64)
+
+// name of the ring of the tree at basePath, an FNV-1a hash of its real path
+void live_name(const char *basePath, char *name, size_t size) {
+  char path[PATH_MAX];
+  const char *at = realpath(basePath, path) != NULL ? path : basePath;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (; *at != '\0'; at++) {
+    hash ^= (unsigned char)*at;
+    hash *= 0x100000001b3ULL;
+  }
+  snprintf(name, size, "/acelog-%016llx", (unsigned long long)hash);
+}
+
+static int slotSize(int dataSize) {
+  return (int)(sizeof(uint64_t) + (dataSize + 7) / 8 * 8);
+}
+
+static live_ring_t *mapRing(int fd, const char *name, int dataSize,
+                            size_t size) {
+  struct stat sb;
+  live_ring_t *ring = malloc(sizeof(live_ring_t));
+  if ((ring == NULL) || (fstat(fd, &sb) < 0)) {
+    free(ring);
+    return NULL;
+  }
+  void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (memory == MAP_FAILED) {
+    free(ring);
+    return NULL;
+  }
+  ring->header = memory;
+  ring->slots = (unsigned char *)memory + kHeaderSize;
+  ring->size = size;
+  ring->dataSize = dataSize;
+  ring->slotSize = slotSize(dataSize);
+  ring->inode = sb.st_ino;
+  snprintf(ring->name, sizeof(ring->name), "%s", name);
+  return ring;
+}
+
+// create the ring called name for records of dataSize bytes, replacing any
+// left by an earlier writer, records is rounded up to a power of two
+live_ring_t *live_create(const char *name, int dataSize, uint32_t records) {
+  uint32_t capacity = 1;
+  while ((capacity < records) && (capacity < (1U << 30)))
+    capacity <<= 1;
+  size_t size = kHeaderSize + (size_t)capacity * slotSize(dataSize);
+  shm_unlink(name);
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0666);
+  if (fd < 0)
+    return NULL;
+  live_ring_t *ring = NULL;
+  if (ftruncate(fd, size) == 0)
+    ring = mapRing(fd, name, dataSize, size);
+  close(fd);
+  if (ring == NULL) {
+    shm_unlink(name);
+    return NULL;
+  }
+  ring->capacity = capacity;
+  live_header_t *header = ring->header;
+  header->closed = 0;
+  header->dataSize = dataSize;
+  header->capacity = capacity;
+  header->sequence = 0;
+  header->waiters = 0;
+  header->head = 0;
+  __atomic_store_n(&header->magic, kMagic, __ATOMIC_RELEASE);
+  return ring;
+}
+
+// map the ring called name, NULL when there is none or its records are not
+// dataSize bytes
+live_ring_t *live_attach(const char *name, int dataSize) {
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0)
+    return NULL;
+  struct stat sb;
+  live_ring_t *ring = NULL;
+  if ((fstat(fd, &sb) == 0) && (sb.st_size > kHeaderSize))
+    ring = mapRing(fd, name, dataSize, sb.st_size);
+  close(fd);
+  if (ring == NULL)
+    return NULL;
+  live_header_t *header = ring->header;
+  uint32_t capacity = header->capacity;
+  if ((__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != kMagic) ||
+      (header->dataSize != (uint32_t)dataSize) || (capacity == 0) ||
+      ((capacity & (capacity - 1)) != 0) ||
+      (kHeaderSize + (size_t)capacity * ring->slotSize > ring->size)) {
+    live_close(ring, false);
+    return NULL;
+  }
+  ring->capacity = capacity;
+  return ring;
+}
+
+// true when the writer of the ring has ended or another has replaced it
+bool live_stale(const live_ring_t *ring) {
+  if (__atomic_load_n(&ring->header->closed, __ATOMIC_ACQUIRE))
+    return true;
+  int fd = shm_open(ring->name, O_RDONLY, 0);
+  if (fd < 0)
+    return true;
+  struct stat sb;
+  bool stale = (fstat(fd, &sb) < 0) || (sb.st_ino != ring->inode);
+  close(fd);
+  return stale;
+}
+
+// unmap the ring, its writer also wakes every reader and removes it
+void live_close(live_ring_t *ring, bool writer) {
+  if (writer) {
+    __atomic_store_n(&ring->header->closed, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&ring->header->sequence, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &ring->header->sequence, FUTEX_WAKE, INT_MAX, NULL,
+            NULL, 0);
+    shm_unlink(ring->name);
+  }
+  munmap(ring->header, ring->size);
+  free(ring);
+}
+
+static uint64_t *slotWords(const live_ring_t *ring, uint64_t index) {
+  return (uint64_t *)(ring->slots +
+                      (size_t)(index & (ring->capacity - 1)) * ring->slotSize);
+}
+
+// publish the next record, readers see it once live_wake is called
+void live_publish(live_ring_t *ring, uint64_t millis, const void *data) {
+  live_header_t *header = ring->header;
+  uint64_t head = __atomic_load_n(&header->head, __ATOMIC_RELAXED);
+  uint64_t *words = slotWords(ring, head);
+  const unsigned char *bytes = data;
+  int offset;
+  // readers copying the slot being replaced must see head move first
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&words[0], millis, __ATOMIC_RELAXED);
+  for (offset = 0; offset < ring->dataSize; offset += 8) {
+    uint64_t word = 0;
+    int length = ring->dataSize - offset < 8 ? ring->dataSize - offset : 8;
+    memcpy(&word, bytes + offset, length);
+    __atomic_store_n(&words[1 + offset / 8], word, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&header->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// wake the readers waiting for records published since the last wake
+void live_wake(live_ring_t *ring) {
+  live_header_t *header = ring->header;
+  uint32_t head = (uint32_t)__atomic_load_n(&header->head, __ATOMIC_RELAXED);
+  __atomic_store_n(&header->sequence, head, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&header->waiters, __ATOMIC_SEQ_CST) != 0)
+    syscall(SYS_futex, &header->sequence, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// copy the record at index, data may be NULL, false when it is not or no
+// longer in the ring
+bool live_read(const live_ring_t *ring, uint64_t index, uint64_t *millis,
+               void *data) {
+  uint64_t head = live_head(ring);
+  if ((index >= head) || (index < live_tail(ring, head)))
+    return false;
+  const uint64_t *words = slotWords(ring, index);
+  unsigned char *bytes = data;
+  *millis = __atomic_load_n(&words[0], __ATOMIC_RELAXED);
+  int offset;
+  for (offset = 0; (bytes != NULL) && (offset < ring->dataSize); offset += 8) {
+    uint64_t word = __atomic_load_n(&words[1 + offset / 8], __ATOMIC_RELAXED);
+    int length = ring->dataSize - offset < 8 ? ring->dataSize - offset : 8;
+    memcpy(bytes + offset, &word, length);
+  }
+  // the copy is good unless the writer had started replacing the slot
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  head = __atomic_load_n(&ring->header->head, __ATOMIC_RELAXED);
+  return head - index < ring->capacity;
+}
+
+// sleep until records past head are published, the writer ends or
+// timeoutMillis pass
+void live_wait(live_ring_t *ring, uint64_t head, int timeoutMillis) {
+  live_header_t *header = ring->header;
+  struct timespec timeout = {timeoutMillis / 1000,
+                             (timeoutMillis % 1000) * 1000000L};
+  __atomic_add_fetch(&header->waiters, 1, __ATOMIC_SEQ_CST);
+  uint32_t sequence = __atomic_load_n(&header->sequence, __ATOMIC_SEQ_CST);
+  if ((sequence == (uint32_t)head) &&
+      !__atomic_load_n(&header->closed, __ATOMIC_ACQUIRE))
+    syscall(SYS_futex, &header->sequence, FUTEX_WAIT, sequence, &timeout,
+            NULL, 0);
+  __atomic_sub_fetch(&header->waiters, 1, __ATOMIC_SEQ_CST);
+}
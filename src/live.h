@@ -0,0 +1,57 @@
+#ifndef LIVE_H
+#define LIVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// records a live ring holds when none is asked for
+#define live_kDefaultRecords (65536)
+
+// start of the shared memory of a live ring, see live.c
+typedef struct {
+  uint32_t magic;
+  uint32_t closed;   // set by the writer as it ends
+  uint32_t dataSize; // bytes of each record's data
+  uint32_t capacity; // records, a power of two
+  uint32_t sequence; // low word of head, readers wait on it
+  uint32_t waiters;  // readers waiting on sequence
+  uint64_t head;     // records published
+} live_header_t;
+
+// a live ring mapped by its writer or a reader
+typedef struct live_ring_s {
+  live_header_t *header;
+  unsigned char *slots;
+  size_t size;
+  uint32_t capacity; // copied from the header when mapped
+  int dataSize;
+  int slotSize;
+  ino_t inode; // of the shared memory object, see live_stale
+  char name[64];
+} live_ring_t;
+
+void live_name(const char *basePath, char *name, size_t size);
+live_ring_t *live_create(const char *name, int dataSize, uint32_t records);
+live_ring_t *live_attach(const char *name, int dataSize);
+bool live_stale(const live_ring_t *ring);
+void live_close(live_ring_t *ring, bool writer);
+void live_publish(live_ring_t *ring, uint64_t millis, const void *data);
+void live_wake(live_ring_t *ring);
+bool live_read(const live_ring_t *ring, uint64_t index, uint64_t *millis,
+               void *data);
+void live_wait(live_ring_t *ring, uint64_t head, int timeoutMillis);
+
+// records published, those from live_tail up to head can be read
+static inline uint64_t live_head(const live_ring_t *ring) {
+  return __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE);
+}
+
+// index of the oldest record still held when head have been published,
+// the slot of the one before is the next to be replaced
+static inline uint64_t live_tail(const live_ring_t *ring, uint64_t head) {
+  return head >= ring->capacity ? head - ring->capacity + 1 : 0;
+}
+
+#endif // LIVE_H
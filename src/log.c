@@ -1,38 +1,137 @@
 #include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <netinet/in.h>
+#include <sched.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <unistd.h>
 
+#include "archive.h"
+#include "cache.h"
+#include "codec.h"
+#include "frame.h"
+#include "index.h"
+#include "journal.h"
+#include "live.h"
 #include "log.h"
 #include "mkdir.h"
+#include "pool.h"
+#include "stats.h"
 
-static bool isSameMinute(time_t t1, time_t t2) {
-  struct tm tm1;
-  gmtime_r(&t1, &tm1);
-  struct tm tm2;
-  gmtime_r(&t2, &tm2);
-  if (tm1.tm_min == tm2.tm_min)
-    return true;
-  return false;
+// UTC time_t has no leap seconds, so hours and minutes start on exact
+// multiples of 3600 and 60 seconds and need no calendar conversion
+
+time_t secondsToHour(time_t seconds) {
+  time_t offset = seconds % 3600;
+  return seconds - (offset < 0 ? offset + 3600 : offset);
 }
 
 uint32_t millisFromHour(struct timespec *ts) {
-  struct tm tm;
-  gmtime_r(&ts->tv_sec, &tm);
   return (uint32_t)(ts->tv_nsec / 1000000LL) +
-         ((uint32_t)tm.tm_min * 60LL + (uint32_t)tm.tm_sec) * 1000LL;
+         (uint32_t)(ts->tv_sec - secondsToHour(ts->tv_sec)) * 1000LL;
 }
 
-time_t secondsToHour(time_t seconds) {
-  struct tm tm;
-  gmtime_r(&seconds, &tm);
-  tm.tm_sec = 0;
-  tm.tm_min = 0;
-  return timegm(&tm);
+// Records are stamped with their time from the hour in the logger's
+// resolution, the stamps of commits and producer rings are epoch times in
+// it, flush and sync policies stay in millis.
+
+// time of ts from hour as records are stamped
+static inline uint32_t stampFrom(log_t *logger, const struct timespec *ts,
+                                 time_t hour) {
+  if (logger->resolution == log_kMicros)
+    return (uint32_t)(ts->tv_sec - hour) * 1000000U +
+           (uint32_t)(ts->tv_nsec / 1000L);
+  return (uint32_t)(ts->tv_sec - hour) * 1000U +
+         (uint32_t)(ts->tv_nsec / 1000000L);
+}
+
+static inline uint32_t stampFromHour(log_t *logger, const struct timespec *ts) {
+  return stampFrom(logger, ts, secondsToHour(ts->tv_sec));
+}
+
+static inline uint64_t stampsPerSecond(log_t *logger) {
+  return logger->resolution == log_kMicros ? 1000000ULL : 1000ULL;
+}
+
+// epoch time of ts as commits return it
+static inline uint64_t epochStamp(log_t *logger, struct timespec *ts) {
+  return logger->resolution == log_kMicros ? log_micros(ts) : log_millis(ts);
+}
+
+static inline uint64_t stampMillis(log_t *logger, uint64_t stamp) {
+  return logger->resolution == log_kMicros ? stamp / 1000ULL : stamp;
+}
+
+// time of an epoch stamp
+static inline void stampTime(log_t *logger, uint64_t stamp,
+                             struct timespec *ts) {
+  uint64_t perSecond = stampsPerSecond(logger);
+  ts->tv_sec = (time_t)(stamp / perSecond);
+  ts->tv_nsec = (long)(stamp % perSecond) * (long)(1000000000ULL / perSecond);
+}
+
+// read the logger's clock source
+static inline void readClock(log_t *logger, struct timespec *ts) {
+  switch (logger->clock) {
+  case log_kClockCoarse:
+    clock_gettime(CLOCK_REALTIME_COARSE, ts);
+    break;
+  case log_kClockAnchored:
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += logger->clockAnchor.tv_sec;
+    ts->tv_nsec += logger->clockAnchor.tv_nsec;
+    if (ts->tv_nsec >= 1000000000L) {
+      ts->tv_nsec -= 1000000000L;
+      ts->tv_sec++;
+    }
+    break;
+  case log_kClockUser:
+    logger->clockFunction(ts, logger->clockContext);
+    break;
+  default:
+    clock_gettime(CLOCK_REALTIME, ts);
+    break;
+  }
+}
+
+// choose where commit timestamps and the reader's idea of now come from,
+// function (called from every committing thread) is for log_kClockUser
+void log_setClock(log_t *logger, log_clock_t clock,
+                  log_clockFunction_t function, void *context) {
+  if ((clock == log_kClockUser) && (function == NULL))
+    clock = log_kClockRealtime;
+  if (clock == log_kClockAnchored) {
+    // realtime at start up carried forward by the monotonic clock, immune
+    // to later steps of the wall clock
+    struct timespec realtime, monotonic;
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    logger->clockAnchor.tv_sec = realtime.tv_sec - monotonic.tv_sec;
+    logger->clockAnchor.tv_nsec = realtime.tv_nsec - monotonic.tv_nsec;
+    if (logger->clockAnchor.tv_nsec < 0) {
+      logger->clockAnchor.tv_nsec += 1000000000L;
+      logger->clockAnchor.tv_sec--;
+    }
+  }
+  logger->clockFunction = function;
+  logger->clockContext = context;
+  logger->clock = clock;
+}
+
+// time of the buffered records, caching the bounds of its minute and hour
+static inline void setFileTime(log_t *logger, time_t seconds) {
+  logger->fileTime = seconds;
+  logger->hourStart = secondsToHour(seconds);
+  logger->minuteStart = seconds - (seconds - logger->hourStart) % 60;
 }
 
 void fileName(time_t t) {
@@ -42,161 +141,3078 @@ void fileName(time_t t) {
           tm.tm_mon + 1, tm.tm_mday, tm.tm_hour);
 }
 
-void writeToDisk(log_t *logger) {
-  if (logger->fileIndex == 0)
-    return;
+static void hourPath(log_t *logger, time_t fileTime, char *filePath) {
   struct tm tm;
-  gmtime_r(&logger->fileTime, &tm);
+  gmtime_r(&fileTime, &tm);
+  sprintf(filePath, "%s%4.4lu/%2.2u/%2.2u/%2.2u.dat", logger->basePath,
+          1900L + tm.tm_year, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour);
+}
+
+// write all of size bytes, retrying short writes
+static bool writeAll(int fd, const unsigned char *data, size_t size) {
+  while (size > 0) {
+    ssize_t written = write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+// bytes of each record as journals and hour indexes note it, 0 when records
+// are variable size frames
+static int recordSizeOf(log_t *logger) {
+  return logger->variable ? 0 : logger->recordSize;
+}
+
+// close the hour file and its index kept open by the writer
+static void closeHourFile(log_t *logger) {
+  if (logger->writeFd >= 0)
+    close(logger->writeFd);
+  logger->writeFd = -1;
+  logger->writeHour = 0;
+  index_close(logger->indexFds);
+}
+
+static void startCompaction(log_t *logger, time_t day); // see log_compact
+
+// open the hour file for hour with O_APPEND, building its day directory
+// only the first time that day is seen
+static bool openHourFile(log_t *logger, time_t hour, const char *directory,
+                         int fileHour) {
+  uint64_t start = stats_nanos();
+  char destination[log_kMaxStrLen * 4];
+  sprintf(destination, "%s/%2.2u.dat", directory, fileHour);
+  time_t day = hour - hour % 86400;
+  closeHourFile(logger);
+  if (logger->writeDay != day) {
+    char path[log_kMaxStrLen * 2];
+    strcpy(path, directory); // build writes into its argument
+    build(path);
+    logger->writeDay = day;
+    if (logger->compact != log_kCompactNone)
+      startCompaction(logger, day);
+  }
+  int fd = open(destination, O_RDWR | O_APPEND | O_CREAT, 0666);
+  if ((fd < 0) && (errno == ENOENT)) {
+    // day directory removed since it was built
+    char path[log_kMaxStrLen * 2];
+    strcpy(path, directory);
+    build(path);
+    fd = open(destination, O_RDWR | O_APPEND | O_CREAT, 0666);
+  }
+  if (fd < 0) {
+    logger->writeDay = 0;
+    return false;
+  }
+  // blocks go only into new files or files already holding blocks
+  struct stat sb;
+  unsigned char header[codec_kHeaderSize];
+  if (fstat(fd, &sb) != 0)
+    sb.st_size = 0;
+  logger->writeBlocks =
+      (sb.st_size == 0) ||
+      ((pread(fd, header, sizeof(header), 0) == sizeof(header)) &&
+       codec_isBlock(header, sb.st_size));
+  logger->writeStream = (uint32_t)sb.st_size;
+  if (logger->writeBlocks && (sb.st_size > 0)) {
+    void *data = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    logger->writeStream = 0;
+    if (data != MAP_FAILED) {
+      logger->writeStream = (uint32_t)codec_decodedSize(data, sb.st_size);
+      munmap(data, sb.st_size);
+    }
+  }
+  logger->writeFd = fd;
+  logger->writeHour = hour;
+  stats_add(&logger->stats.hoursWritten, 1);
+  stats_record(&logger->stats.openNanos, stats_nanos() - start);
+  return true;
+}
+
+// append a buffer of records to the hourly file for fileTime, the file is
+// kept open until a buffer for another hour comes along
+static bool writeBuffer(log_t *logger, const unsigned char *buffer, int size,
+                        time_t fileTime) {
+  uint64_t start = stats_nanos();
+  struct tm tm;
+  gmtime_r(&fileTime, &tm);
   // path
   char directory[log_kMaxStrLen * 2];
   sprintf(directory, "%s%4.4lu/%2.2u/%2.2u", logger->basePath,
           1900L + tm.tm_year, tm.tm_mon + 1, tm.tm_mday);
-  build(directory);
+  time_t hour = secondsToHour(fileTime);
+  if ((logger->writeFd < 0) || (logger->writeHour != hour))
+    if (!openHourFile(logger, hour, directory, tm.tm_hour))
+      return false;
 
-  // build path and file name
-  char destination[log_kMaxStrLen * 4];
-  sprintf(destination, "%s/%2.2u.dat", directory, tm.tm_hour);
+  int recordSize = recordSizeOf(logger);
+  off_t offset = 0;
+  if (logger->journal != NULL)
+    offset = lseek(logger->writeFd, 0, SEEK_END);
+  journal_header_t *header = NULL;
+  if (logger->journal != NULL) {
+    // recovery cuts the hour file back to here if the write is torn, so
+    // this must reach the device before any of the write can
+    header = journal_header((unsigned char *)buffer);
+    header->flushOffset = offset + 1;
+    if (logger->sync != log_kSyncNone)
+      journal_sync((unsigned char *)buffer, size);
+  }
+  bool written;
+  if (logger->compress && logger->writeBlocks) {
+    int blockSize =
+        codec_encode(buffer, size, recordSize, logger->encodeBuffer);
+    written = writeAll(logger->writeFd, logger->encodeBuffer, blockSize);
+    if (written)
+      stats_add(&logger->stats.bytesWritten, blockSize);
+  } else {
+    written = writeAll(logger->writeFd, buffer, size);
+    logger->writeBlocks = false;
+    if (written)
+      stats_add(&logger->stats.bytesWritten, size);
+  }
+  if (!written) {
+    if (header != NULL)
+      ftruncate(logger->writeFd, offset); // the retry starts on a record
+    closeHourFile(logger); // reopen on the next write
+    return false;
+  }
+  // records are indexed by where they start in the record stream, and the
+  // summary by the file size, which readers check it against
+  uint32_t streamOffset = logger->writeStream;
+  logger->writeStream += size;
+  if (!index_append(logger->indexFds, directory, tm.tm_hour, buffer, size,
+                    recordSize, streamOffset,
+                    (uint32_t)lseek(logger->writeFd, 0, SEEK_END))) {
+    fprintf(stderr, "Error : Log Index Update Failed\n");
+    index_forget(logger->indexFds, directory, tm.tm_hour);
+  }
+  if (header != NULL) {
+    // the records must be on the device before the journal lets them go
+    if (logger->sync != log_kSyncNone)
+      fdatasync(logger->writeFd);
+    header->size = 0;
+    header->flushOffset = 0;
+    // else after a crash recovery would take records committed to the
+    // buffer since for these, and write them again
+    if (logger->sync != log_kSyncNone)
+      journal_sync((unsigned char *)buffer, 0);
+  }
+  stats_record(&logger->stats.flushNanos, stats_nanos() - start);
+  return true;
+}
 
-  // write / append buffer to file
-  FILE *fd = fopen(destination, "a");
-  if (fd != NULL) {
-    fwrite(logger->fileBuffer, 1, logger->fileIndex, fd);
-    fclose(fd);
+// publish count buffered records of the current hour to the live ring, the
+// ring holds their data without any source id
+static void publishLive(log_t *logger, const unsigned char *records,
+                        int count) {
+  int logRecordSize = logger->recordSize;
+  uint64_t hourStamp = (uint64_t)logger->hourStart * stampsPerSecond(logger);
+  int index;
+  for (index = 0; index < count; index++) {
+    const unsigned char *record = &records[index * logRecordSize];
+    live_publish(logger->live, hourStamp + ntohl(*(uint32_t *)record),
+                 record + logRecordSize - logger->dataSize);
+  }
+  live_wake(logger->live);
+}
+
+// whether commits are published as they are made, records a logger
+// dropping its oldest may still drop are published as they are written out
+static inline bool publishOnCommit(log_t *logger) {
+  return (logger->live != NULL) && (logger->overflow != log_kDropOldest);
+}
+
+// publish the records of the active buffer as it is written out, when they
+// were not published as committed
+static void publishBuffer(log_t *logger) {
+  if ((logger->live != NULL) && !publishOnCommit(logger))
+    publishLive(logger, logger->buffer, logger->fileIndex / logger->recordSize);
+}
+
+// hand the active buffer to the flush thread and carry on with the spare
+static void queueFlush(log_t *logger) {
+  pthread_mutex_lock(&logger->flushLock);
+  while (logger->flushIndex != 0) // previous buffer still being written
+    pthread_cond_wait(&logger->flushDone, &logger->flushLock);
+  // the ring then pushes out only records already written
+  publishBuffer(logger);
+  unsigned char *spare = logger->flushBuffer;
+  logger->flushBuffer = logger->buffer;
+  logger->flushIndex = logger->fileIndex;
+  logger->flushTime = logger->fileTime;
+  logger->buffer = spare;
+  logger->fileIndex = 0;
+  pthread_cond_signal(&logger->flushReady);
+  pthread_mutex_unlock(&logger->flushLock);
+}
+
+// records in size bytes of a write buffer
+static uint64_t bufferRecords(log_t *logger, const unsigned char *buffer,
+                              int size) {
+  if (!logger->variable)
+    return size / logger->recordSize;
+  uint64_t records = 0;
+  size_t at = 0;
+  size_t bytes;
+  uint32_t data;
+  while ((at < (size_t)size) &&
+         ((bytes = frame_size(&buffer[at], size - at, &data)) != 0)) {
+    at += bytes;
+    records++;
+  }
+  return records;
+}
+
+#define kFlushAttempts (3)
+#define kFlushRetryMillis (100)
+
+// write the buffer handed to the flush thread, pausing before each retry,
+// counting its records lost when every attempt fails
+static void writeQueued(log_t *logger) {
+  int attempt;
+  for (attempt = 0; attempt < kFlushAttempts; attempt++) {
+    if (attempt > 0) {
+      struct timespec pause = {0, kFlushRetryMillis * 1000000L};
+      nanosleep(&pause, NULL);
+    }
+    if (writeBuffer(logger, logger->flushBuffer, logger->flushIndex,
+                    logger->flushTime))
+      return;
+  }
+  fprintf(stderr, "Error : Log File Write Failed\n");
+  stats_add(&logger->stats.counters.lostRecords,
+            bufferRecords(logger, logger->flushBuffer, logger->flushIndex));
+}
+
+static void *flushTask(void *context) {
+  log_t *logger = (log_t *)context;
+  pthread_mutex_lock(&logger->flushLock);
+  while (true) {
+    while ((logger->flushIndex == 0) && !logger->stop)
+      pthread_cond_wait(&logger->flushReady, &logger->flushLock);
+    if (logger->flushIndex == 0)
+      break; // stop requested and nothing left to write
+    // producers only swap buffers while flushIndex is zero
+    pthread_mutex_unlock(&logger->flushLock);
+    writeQueued(logger);
+    // the stats file is written here too, off the committing thread
+    if (logger->statsPath != NULL)
+      stats_dump(logger, logger->flushTime);
+    pthread_mutex_lock(&logger->flushLock);
+    logger->flushIndex = 0;
+    pthread_cond_signal(&logger->flushDone);
+  }
+  pthread_mutex_unlock(&logger->flushLock);
+  return NULL;
+}
+
+void writeToDisk(log_t *logger) {
+  // readers never take a write buffer, fileIndex is then their cursor
+  if ((logger->fileIndex == 0) || (logger->buffer == NULL))
+    return;
+  stats_add(&logger->stats.counters.flushes, 1);
+  if (logger->async) {
+    queueFlush(logger);
+    return;
+  }
+  if (writeBuffer(logger, logger->buffer, logger->fileIndex,
+                  logger->fileTime)) {
+    publishBuffer(logger);
     logger->fileIndex = 0;
   }
+  if (logger->statsPath != NULL)
+    stats_dump(logger, logger->fileTime);
 }
 
-void log_begin(log_t *logger, const char *logPath, int dataSize) {
+// start the background flush thread with a spare buffer to swap in
+static bool startFlushThread(log_t *logger) {
+  if (logger->journal == NULL)
+    logger->flushBuffer = pool_get(logger->bufferSize);
+  if (logger->flushBuffer == NULL)
+    return false;
+  logger->flushIndex = 0;
+  logger->stop = false;
+  pthread_mutex_init(&logger->flushLock, NULL);
+  pthread_cond_init(&logger->flushReady, NULL);
+  pthread_cond_init(&logger->flushDone, NULL);
+  if (pthread_create(&logger->flushThread, NULL, flushTask, logger) != 0) {
+    pthread_cond_destroy(&logger->flushDone);
+    pthread_cond_destroy(&logger->flushReady);
+    pthread_mutex_destroy(&logger->flushLock);
+    if (logger->journal == NULL)
+      pool_put(logger->flushBuffer, logger->bufferSize);
+    return false; // logger still works, writing from log_commit
+  }
+  logger->async = true;
+  return true;
+}
+
+// write out the records a crashed logger left in its journal
+static void recoverJournal(log_t *logger, unsigned char *journal,
+                           size_t size) {
+  unsigned char *buffers[journal_kMaxBuffers];
+  int count = journal_buffers(journal, size, buffers);
+  if ((count == 2) &&
+      (journal_header(buffers[1])->fileTime <
+       journal_header(buffers[0])->fileTime)) {
+    unsigned char *older = buffers[1]; // the spare was being flushed
+    buffers[1] = buffers[0];
+    buffers[0] = older;
+  }
+  int recordSize = recordSizeOf(logger);
+  int index;
+  for (index = 0; index < count; index++) {
+    journal_header_t *header = journal_header(buffers[index]);
+    if (header->size == 0)
+      continue;
+    if ((int)header->recordSize != recordSize) {
+      fprintf(stderr, "Error : Log Journal Record Size Mismatch\n");
+      continue;
+    }
+    char path[log_kMaxStrLen * 2];
+    hourPath(logger, header->fileTime, path);
+    if (header->flushOffset != 0) {
+      // torn flush, drop what reached the hour file and rebuild its index
+      closeHourFile(logger); // reopened at its new size
+      if (truncate(path, header->flushOffset - 1) == 0) {
+        strcpy(path + strlen(path) - 3, "idx");
+        unlink(path);
+      }
+    } else {
+      // mark the flush as a logger does, so a crash during recovery is
+      // recovered in turn rather than writing the records twice
+      struct stat sb;
+      header->flushOffset = (stat(path, &sb) == 0 ? sb.st_size : 0) + 1;
+      journal_sync(buffers[index], header->size);
+    }
+    // only whole frames are ever published
+    int records = recordSize != 0 ? header->size - header->size % recordSize
+                                  : (int)header->size;
+    if (!writeBuffer(logger, buffers[index], records, header->fileTime))
+      fprintf(stderr, "Error : Log Journal Recovery Failed\n");
+  }
+  if (logger->writeFd >= 0)
+    fdatasync(logger->writeFd);
+  closeHourFile(logger);
+}
+
+// map basePath/journal as the write buffers, after recovering what it holds
+static bool openJournal(log_t *logger, bool async) {
+  char path[log_kMaxStrLen * 2];
+  strcpy(path, logger->basePath);
+  if (path[0] != '\0')
+    build(path);
+  sprintf(path, "%sjournal", logger->basePath);
+  int fd = open(path, O_RDWR | O_CREAT, 0666);
+  if (fd < 0)
+    return false;
+  if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+    fprintf(stderr, "Error : Log Journal In Use\n");
+    close(fd);
+    return false;
+  }
+  size_t size;
+  unsigned char *journal = journal_map(fd, &size);
+  if (journal != NULL) {
+    recoverJournal(logger, journal, size);
+    munmap(journal, size);
+  }
+  int count = async ? 2 : 1;
+  logger->journal = journal_create(fd, logger->bufferSize, recordSizeOf(logger),
+                                   count, &logger->journalSize);
+  if (logger->journal == NULL) {
+    close(fd);
+    return false;
+  }
+  unsigned char *buffers[journal_kMaxBuffers];
+  journal_buffers(logger->journal, logger->journalSize, buffers);
+  logger->buffer = buffers[0];
+  logger->flushBuffer = async ? buffers[1] : NULL;
+  logger->journalFd = fd;
+  return true;
+}
+
+// publish the records in the write buffer to the journal, syncing it to
+// the device as the policy asks
+static void journalCommit(log_t *logger, uint64_t millis, int records) {
+  if ((logger->journal == NULL) || (logger->buffer == NULL))
+    return;
+  journal_header_t *header = journal_header(logger->buffer);
+  header->fileTime = logger->fileTime;
+  __atomic_store_n(&header->size, logger->fileIndex, __ATOMIC_RELEASE);
+  logger->unsynced += records;
+  if (((logger->sync == log_kSyncRecords) &&
+       (logger->unsynced >= logger->syncEvery)) ||
+      ((logger->sync == log_kSyncInterval) &&
+       (millis >= logger->syncMillis + logger->syncEvery))) {
+    msync(logger->journal, logger->journalSize, MS_SYNC);
+    logger->unsynced = 0;
+    logger->syncMillis = millis;
+  }
+}
+
+// unmap the journal, removing it when every record reached its hour file
+static void closeJournal(log_t *logger) {
+  if (logger->journal == NULL)
+    return;
+  unsigned char *buffers[journal_kMaxBuffers];
+  int count = journal_buffers(logger->journal, logger->journalSize, buffers);
+  bool empty = true;
+  while (count-- > 0)
+    empty = empty && (journal_header(buffers[count])->size == 0);
+  if (empty) {
+    char path[log_kMaxStrLen * 2];
+    sprintf(path, "%sjournal", logger->basePath);
+    unlink(path);
+  } else {
+    msync(logger->journal, logger->journalSize, MS_SYNC);
+  }
+  munmap(logger->journal, logger->journalSize);
+  close(logger->journalFd);
+  logger->journal = NULL;
+  logger->buffer = NULL;
+  logger->flushBuffer = NULL;
+}
+
+// create the live ring of basePath, big enough that a record leaves it only
+// after its buffer has been written out
+static bool openLive(log_t *logger, int records) {
+  char path[log_kMaxStrLen];
+  char name[64];
+  strcpy(path, logger->basePath[0] != '\0' ? logger->basePath : ".");
+  build(path);
+  int recordSize = logger->recordSize;
+  if (records <= 0)
+    records = live_kDefaultRecords;
+  if (records < 2 * (logger->bufferSize / recordSize))
+    records = 2 * (logger->bufferSize / recordSize);
+  live_name(path, name, sizeof(name));
+  logger->live = live_create(name, logger->dataSize, records);
+  if (logger->live != NULL)
+    return true;
+  fprintf(stderr, "Error : Log Live Ring Create Failed\n");
+  return false;
+}
+
+// start a logger, buffers are taken from a process wide pool when first
+// used, returns false when compression, the journal, live ring or
+// background flush thread asked for could not start, the logger then
+// works without them and still needs log_end
+bool log_open(log_t *logger, const log_config_t *config) {
+  int dataSize = config->dataSize;
+  int recordSize = dataSize + sizeof(uint32_t) +
+                   (config->sources ? log_kSourceSize : 0);
+  if (config->variable)
+    recordSize = dataSize + frame_kMaxHeader;
   logger->dataSize = dataSize;
+  logger->recordSize = dataSize + sizeof(uint32_t);
+  logger->bufferSize =
+      config->bufferSize > 0 ? config->bufferSize : log_kFileBufferSize;
+  if (logger->bufferSize < 2 * recordSize)
+    logger->bufferSize = 2 * recordSize;
+  logger->windowSize =
+      config->windowSize > 0 ? config->windowSize : log_kFileBufferSize;
+  logger->flushBytes = logger->bufferSize - 1;
+  if ((config->flushBytes > 0) && (config->flushBytes < logger->flushBytes))
+    logger->flushBytes =
+        config->flushBytes < recordSize ? recordSize : config->flushBytes;
+  logger->flushMillis = config->flushMillis > 0 ? config->flushMillis : 0;
+  logger->flushDue = UINT64_MAX;
+  logger->overflow = config->overflow;
+  memset(&logger->stats, 0, sizeof(logger->stats));
+  memset(&logger->statsBase, 0, sizeof(logger->statsBase));
+  memset(&logger->dumpBase, 0, sizeof(logger->dumpBase));
+  pthread_mutex_init(&logger->statsLock, NULL);
+  logger->timing = config->timing;
+  logger->statsPath =
+      config->statsPath != NULL ? strdup(config->statsPath) : NULL;
+  logger->statsSeconds = config->statsSeconds > 0 ? config->statsSeconds : 60;
+  logger->statsDue = 0;
   logger->fileIndex = 0;
+  logger->fileSize = 0;
   logger->fileTime = 0;
+  logger->minuteStart = 0;
+  logger->hourStart = 0;
+  logger->clock = log_kClockRealtime;
+  logger->clockFunction = NULL;
+  logger->resolution =
+      config->resolution == log_kMicros ? log_kMicros : log_kMillis;
+  logger->buffer = NULL;
+  logger->window = NULL;
+  logger->readBuffer = NULL;
+  logger->cached = NULL;
+  logger->writeFd = -1;
+  logger->writeHour = 0;
+  logger->writeDay = 0;
+  logger->indexFds[0] = -1;
+  logger->indexFds[1] = -1;
+  logger->journal = NULL;
+  logger->flushBuffer = NULL;
+  logger->sync = config->sync;
+  logger->syncEvery = config->syncEvery > 0 ? config->syncEvery : 1;
+  logger->unsynced = 0;
+  logger->syncMillis = 0;
+  logger->mapped = false;
+  logger->mapping = NULL;
+  logger->compress = false;
+  logger->encodeBuffer = NULL;
+  logger->decodeBuffer = NULL;
+  logger->decodeCapacity = 0;
+  logger->sourced = false;
+  logger->fieldCount = 0;
+  logger->archive = NULL;
+  logger->compact = config->compact;
+  logger->compacting = false;
+  logger->live = NULL;
+  logger->follow = NULL;
+  logger->followNext = 0;
+  logger->followMillis = 0;
+  logger->variable = config->variable;
+  logger->readSize = 0;
+  logger->readPrev = -1;
+  logger->skips = NULL;
+  logger->skipCount = 0;
+  logger->skipCapacity = 0;
+  logger->async = false;
+  logger->producers = NULL;
+  logger->drainMinute = 0;
+  pthread_mutex_init(&logger->drainLock, NULL);
+  const char *logPath = config->path != NULL ? config->path : "";
   int length = strnlen(logPath, log_kMaxStrLen);
-  strncpy(logger->basePath, logPath, log_kMaxStrLen - 1);
+  logger->basePath[0] = '\0';
+  strncat(logger->basePath, logPath, log_kMaxStrLen - 2);
   if (length) {
     if (logger->basePath[length - 1] != '/')
       strncat(logger->basePath, "/", log_kMaxStrLen - 1);
   }
+  logger->mapped = config->mapped;
+  if (config->variable && (config->compress || config->sources ||
+                           config->live ||
+                           (config->compact != log_kCompactNone))) {
+    // these all rely on records of one size
+    fprintf(stderr, "Error : Log Option Needs Fixed Size Records\n");
+    logger->compact = log_kCompactNone;
+  }
+  if (config->sources && !logger->variable)
+    log_useSources(logger);
+  if (config->clock != log_kClockRealtime)
+    log_setClock(logger, config->clock, config->clockFunction,
+                 config->clockContext);
+  bool opened = true;
+  if (config->compress && !logger->variable && !log_compress(logger, true))
+    opened = false;
+  if (config->journal && !openJournal(logger, config->async)) {
+    fprintf(stderr, "Error : Log Journal Open Failed\n");
+    opened = false;
+  }
+  if (config->live && !logger->variable &&
+      !openLive(logger, config->liveRecords))
+    opened = false;
+  if (config->async)
+    return startFlushThread(logger) && opened;
+  return opened;
 }
 
-void appendToLogBuffer(log_t *logger, uint32_t time, void *data) {
-  // check for space in log file Buffer
-  int logRecordSize = logger->dataSize + sizeof(uint32_t);
-  if (logger->fileIndex + logRecordSize >= log_kFileBufferSize) {
-    logger->fileIndex = 0; // just restart on overun
-    fprintf(stderr, "Error : Log File Buffer Overun\n");
+void log_begin(log_t *logger, const char *logPath, int dataSize) {
+  log_config_t config = {.path = logPath, .dataSize = dataSize};
+  log_open(logger, &config);
+}
+
+// as log_begin, but reads map hour files rather than copying them into
+// the read window, log_readPtr and log_nextPtr then point into the mapping
+void log_beginMapped(log_t *logger, const char *logPath, int dataSize) {
+  log_config_t config = {.path = logPath, .dataSize = dataSize,
+                         .mapped = true};
+  log_open(logger, &config);
+}
+
+// write hour files as compressed blocks, files already holding legacy
+// records carry on uncompressed until the next hour, returns false when
+// records vary in size or the encode buffer cannot be allocated
+bool log_compress(log_t *logger, bool enable) {
+  if (enable && logger->variable)
+    return false;
+  // sources added later only make records larger and blocks smaller
+  if (enable && (logger->encodeBuffer == NULL)) {
+    logger->encodeBuffer =
+        malloc(codec_bound(logger->bufferSize, logger->recordSize));
+    if (logger->encodeBuffer == NULL) {
+      fprintf(stderr, "Error : Log Encode Buffer Allocation Failed\n");
+      return false;
+    }
   }
+  logger->compress = enable;
+  return true;
+}
+
+// as log_begin, but buffers are written to disk by a background thread
+bool log_beginAsync(log_t *logger, const char *logPath, int dataSize) {
+  log_config_t config = {.path = logPath, .dataSize = dataSize,
+                         .async = true};
+  return log_open(logger, &config);
+}
+
+// take the write buffer from the pool on first use
+static bool takeBuffer(log_t *logger) {
+  if (logger->buffer == NULL)
+    logger->buffer = pool_get(logger->bufferSize);
+  if (logger->buffer != NULL)
+    return true;
+  fprintf(stderr, "Error : Log Buffer Allocation Failed\n");
+  return false;
+}
+
+// write out the buffer ahead of the minute, counting why
+static void flushEarly(log_t *logger, uint64_t *reason) {
+  if (logger->async &&
+      (__atomic_load_n(&logger->flushIndex, __ATOMIC_ACQUIRE) != 0))
+    stats_add(&logger->stats.counters.blocked, 1);
+  stats_add(reason, 1);
+  writeToDisk(logger);
+}
+
+// drop the oldest quarter of the buffered records
+static void dropOldest(log_t *logger) {
+  int logRecordSize = logger->recordSize;
+  int records = logger->fileIndex / logRecordSize;
+  int drop = (records + 3) / 4;
+  int bytes = drop * logRecordSize;
+  if (logger->variable) {
+    // whole frames holding at least a quarter of the bytes
+    uint32_t size;
+    for (drop = 0, bytes = 0; bytes < (logger->fileIndex + 3) / 4; drop++)
+      bytes += frame_size(&logger->buffer[bytes], logger->fileIndex - bytes,
+                          &size);
+  }
+  memmove(logger->buffer, logger->buffer + bytes, logger->fileIndex - bytes);
+  logger->fileIndex -= bytes;
+  stats_add(&logger->stats.counters.droppedOldest, drop);
+}
+
+// make room for a record of size bytes in a buffer filled to flushBytes,
+// writing it out, or when that cannot be done yet filling on to bufferSize
+// before the overflow policy applies, returns false when it is dropped
+static bool makeRoom(log_t *logger, int size) {
+  bool busy = logger->async &&
+              (__atomic_load_n(&logger->flushIndex, __ATOMIC_ACQUIRE) != 0);
+  if (!busy || (logger->overflow == log_kBlock))
+    flushEarly(logger, &logger->stats.counters.fullFlushes);
+  if (logger->fileIndex + size <= logger->bufferSize)
+    return true;
+  // the flush thread is still busy, or the write failed, and the buffer
+  // is full
+  if (logger->overflow == log_kDropOldest) {
+    dropOldest(logger);
+    return true;
+  }
+  stats_add(&logger->stats.counters.droppedNewest, 1);
+  return false;
+}
+
+// stamp the next record, of size bytes with its timestamp, in the log file
+// buffer, returns where the rest of it goes
+static unsigned char *reserveRecord(log_t *logger, uint32_t time,
+                                    int logRecordSize) {
+  // check for space in log file Buffer
+  if (!takeBuffer(logger))
+    return NULL;
+  if ((logger->fileIndex + logRecordSize > logger->flushBytes) &&
+      !makeRoom(logger, logRecordSize))
+    return NULL;
+  if ((logger->fileIndex == 0) && (logger->flushMillis != 0))
+    logger->flushDue = (uint64_t)logger->hourStart * 1000LL +
+                       stampMillis(logger, time) + logger->flushMillis;
   // add timestamp to log file buffer
-  *(uint32_t *)&logger->fileBuffer[logger->fileIndex] = htonl(time);
-  // add data to log file buffer
-  memcpy(&logger->fileBuffer[logger->fileIndex + sizeof(uint32_t)], data,
-         logger->dataSize);
+  unsigned char *record = &logger->buffer[logger->fileIndex];
+  *(uint32_t *)record = htonl(time);
   logger->fileIndex += logRecordSize; // update the log file buffer index
+  return record + sizeof(uint32_t);
+}
+
+// frame size bytes of data in the log file buffer, see frame.h
+static void appendFrame(log_t *logger, uint32_t time, const void *data,
+                        int size) {
+  unsigned char length[frame_kMaxHeader];
+  int lengthBytes = frame_putSize(length, size);
+  unsigned char *record =
+      reserveRecord(logger, time, sizeof(uint32_t) + lengthBytes + size);
+  if (record == NULL)
+    return;
+  memcpy(record, length, lengthBytes);
+  memcpy(record + lengthBytes, data, size);
+}
+
+void appendToLogBuffer(log_t *logger, uint32_t time, void *data) {
+  if (logger->variable) {
+    appendFrame(logger, time, data, logger->dataSize);
+    return;
+  }
+  // add data to log file buffer
+  unsigned char *record = reserveRecord(logger, time, logger->recordSize);
+  if (record == NULL)
+    return;
+  if (logger->sourced) {
+    memset(record, 0, log_kSourceSize); // committed without a source
+    record += log_kSourceSize;
+  }
+  memcpy(record, data, logger->dataSize);
+  if (publishOnCommit(logger))
+    publishLive(logger, record + logger->dataSize - logger->recordSize, 1);
+}
+
+// ready the buffer for a record of epoch time stamp, writing it out first
+// when the record belongs to another hour or the flush policy says so,
+// returns the time from hour to stamp the record with
+static uint32_t startRecord(log_t *logger, uint64_t stamp) {
+  uint64_t perSecond = stampsPerSecond(logger);
+  time_t seconds = (time_t)(stamp / perSecond);
+  time_t hour = seconds - seconds % 3600;
+  if ((logger->fileIndex != 0) && (hour != logger->hourStart))
+    writeToDisk(logger);
+  else if ((logger->fileIndex != 0) &&
+           (stampMillis(logger, stamp) >= logger->flushDue))
+    flushEarly(logger, &logger->stats.counters.timedFlushes);
+  if (logger->fileIndex == 0)
+    setFileTime(logger, seconds);
+  return (uint32_t)(stamp - (uint64_t)hour * perSecond);
+}
+
+// append a record of epoch time stamp
+static void appendRecord(log_t *logger, uint64_t stamp, void *data) {
+  appendToLogBuffer(logger, startRecord(logger, stamp), data);
+  journalCommit(logger, stampMillis(logger, stamp), 1);
+  stats_add(&logger->stats.records, 1);
 }
 
 uint64_t log_millis(struct timespec *ts) {
-  return (uint64_t)millisFromHour(ts) +
-         (uint64_t)secondsToHour(ts->tv_sec) * 1000LL;
+  return (uint64_t)ts->tv_sec * 1000LL + (uint64_t)ts->tv_nsec / 1000000LL;
 }
 
-uint64_t log_commit(log_t *logger, void *data) {
+uint64_t log_micros(struct timespec *ts) {
+  return (uint64_t)ts->tv_sec * 1000000LL + (uint64_t)ts->tv_nsec / 1000LL;
+}
+
+// timestamp a commit, writing out the buffer when the minute rolls over,
+// returns the time from hour to stamp the record with
+static uint32_t beginCommit(log_t *logger, struct timespec *ts) {
   // get millisecond timestamp for this log commit
-  struct timespec ts;
-  clock_gettime(CLOCK_REALTIME, &ts);
-  time_t secondsNow = ts.tv_sec;
+  readClock(logger, ts);
+  time_t secondsNow = ts->tv_sec;
 
-  if (logger->fileTime == 0)
-    logger->fileTime = secondsNow;
-  if (!isSameMinute(logger->fileTime, secondsNow)) {
+  // within the cached minute this is two integer compares
+  if ((secondsNow < logger->minuteStart) ||
+      (secondsNow >= logger->minuteStart + 60)) {
     writeToDisk(logger);
-    logger->fileTime = secondsNow;
+    setFileTime(logger, secondsNow);
+  } else if ((logger->fileIndex != 0) && (log_millis(ts) >= logger->flushDue)) {
+    flushEarly(logger, &logger->stats.counters.timedFlushes);
   }
-  uint32_t millisNow = millisFromHour(&ts);
+  return stampFrom(logger, ts, logger->hourStart);
+}
+
+uint64_t log_commit(log_t *logger, void *data) {
+  uint64_t start = logger->timing ? stats_nanos() : 0;
+  struct timespec ts;
+  uint32_t millisNow = beginCommit(logger, &ts);
   appendToLogBuffer(logger, millisNow, data);
-  return log_millis(&ts);
+  journalCommit(logger, log_millis(&ts), 1);
+  stats_add(&logger->stats.records, 1);
+  if (logger->timing)
+    stats_record(&logger->stats.commitNanos, stats_nanos() - start);
+  return epochStamp(logger, &ts);
 }
 
-void log_end(log_t *logger) {
-  if (logger->fileIndex != 0) {
-    writeToDisk(logger);
+// commit size bytes of data, at most dataSize, to a logger opened with
+// variable set, returns 0 when size is out of range
+uint64_t log_commitSize(log_t *logger, const void *data, int size) {
+  if (!logger->variable || (size < 0) || (size > logger->dataSize)) {
+    fprintf(stderr, "Error : Log Record Size Invalid\n");
+    return 0;
   }
+  uint64_t start = logger->timing ? stats_nanos() : 0;
+  struct timespec ts;
+  uint32_t millisNow = beginCommit(logger, &ts);
+  appendFrame(logger, millisNow, data, size);
+  journalCommit(logger, log_millis(&ts), 1);
+  stats_add(&logger->stats.records, 1);
+  if (logger->timing)
+    stats_record(&logger->stats.commitNanos, stats_nanos() - start);
+  return epochStamp(logger, &ts);
 }
 
-bool nextHour(struct timespec *ts) {
-  ts->tv_sec = secondsToHour(ts->tv_sec) + 3600LL;
-  ts->tv_nsec = 0;
-  struct timespec now;
-  clock_gettime(CLOCK_REALTIME, &now);
-  return (ts->tv_sec < now.tv_sec);
+// records of a logger using sources start with a big endian source id
+// between the timestamp and the dataSize bytes of data, commits without a
+// source give it 0 and reads other than log_readSource skip it
+void log_useSources(log_t *logger) {
+  if (!logger->sourced) {
+    logger->sourced = true;
+    logger->recordSize += log_kSourceSize;
+  }
 }
 
-// read hourly data log file into buffer, return bytes read
-int getBuffer(log_t *logger, time_t fileTime) {
-  struct tm tm;
-  char filePath[log_kMaxStrLen * 2];
-  gmtime_r(&fileTime, &tm);
-  sprintf(filePath, "%s%4.4lu/%2.2u/%2.2u/%2.2u.dat", logger->basePath,
-          1900L + tm.tm_year, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour);
-  logger->fileTime = secondsToHour(fileTime);
-  logger->fileIndex = 0;
-  FILE *fd = fopen(filePath, "r");
-  if (fd != NULL) {
-    logger->fileSize = fread(logger->fileBuffer, 1, log_kFileBufferSize, fd);
-    fclose(fd);
-  } else {
-    logger->fileSize = 0;
+// commit data from source, data is dataSize bytes without the source id
+uint64_t log_commitSource(log_t *logger, uint32_t source, void *data) {
+  uint64_t start = logger->timing ? stats_nanos() : 0;
+  struct timespec ts;
+  uint32_t millisNow = beginCommit(logger, &ts);
+  unsigned char *record = reserveRecord(logger, millisNow, logger->recordSize);
+  if (record == NULL)
+    return epochStamp(logger, &ts);
+  *(uint32_t *)record = htonl(source);
+  memcpy(record + log_kSourceSize, data, logger->dataSize);
+  if (publishOnCommit(logger))
+    publishLive(logger, record - sizeof(uint32_t), 1);
+  journalCommit(logger, log_millis(&ts), 1);
+  stats_add(&logger->stats.records, 1);
+  if (logger->timing)
+    stats_record(&logger->stats.commitNanos, stats_nanos() - start);
+  return epochStamp(logger, &ts);
+}
+
+// number of records held in a producer ring
+static inline uint32_t ringCount(log_producer_t *producer, uint32_t head,
+                                 uint32_t tail) {
+  return (head + 2 * producer->records - tail) % (2 * producer->records);
+}
+
+static inline unsigned char *ringRecord(log_producer_t *producer,
+                                        uint32_t position) {
+  int ringRecordSize = producer->logger->dataSize + sizeof(uint64_t);
+  return &producer->ring[(position % producer->records) * ringRecordSize];
+}
+
+// merge producer records stamped before cutoff into the logger buffer in
+// time order, caller holds drainLock
+static void drainProducers(log_t *logger, uint64_t cutoff) {
+  log_producer_t *producer;
+  // a commit in progress may hold a timestamp older than cutoff
+  for (producer = logger->producers; producer; producer = producer->next) {
+    while (__atomic_load_n(&producer->busy, __ATOMIC_SEQ_CST))
+      sched_yield();
   }
-  // fprintf(stdout, "getBuffer %s %d\n", filePath, logger->fileSize);
-  return logger->fileSize;
+  uint32_t heads[log_kMaxProducers];
+  int count = 0;
+  for (producer = logger->producers; producer; producer = producer->next)
+    heads[count++] = __atomic_load_n(&producer->head, __ATOMIC_ACQUIRE);
+
+  while (true) {
+    // producer rings are each time ordered, take the oldest head record
+    log_producer_t *oldest = NULL;
+    uint64_t oldestStamp = cutoff;
+    int index = 0;
+    for (producer = logger->producers; producer; producer = producer->next) {
+      if (producer->tail != heads[index++]) {
+        uint64_t stamp;
+        memcpy(&stamp, ringRecord(producer, producer->tail), sizeof(stamp));
+        if (stamp < oldestStamp) {
+          oldestStamp = stamp;
+          oldest = producer;
+        }
+      }
+    }
+    if (oldest == NULL)
+      break;
+    appendRecord(logger, oldestStamp,
+                 ringRecord(oldest, oldest->tail) + sizeof(uint64_t));
+    __atomic_store_n(&oldest->tail, (oldest->tail + 1) % (2 * oldest->records),
+                     __ATOMIC_RELEASE);
+  }
+  writeToDisk(logger);
 }
 
-int getFileBuffer(log_t *logger, struct timespec *ts) {
-  int bytesRead = 0;
-  while ((bytesRead = getBuffer(logger, ts->tv_sec)) == 0) {
-    if (nextHour(ts) == false) {
-      return 0;
+// attach a producer with its own staging ring of records, one per
+// producing thread, NULL when records is not positive
+log_producer_t *log_attach(log_t *logger, int records) {
+  if (records <= 0) {
+    fprintf(stderr, "Error : Log Producer Ring Size Invalid\n");
+    return NULL;
+  }
+  log_producer_t *producer = malloc(sizeof(log_producer_t));
+  if (producer == NULL)
+    return NULL;
+  producer->ring =
+      malloc((size_t)records * (logger->dataSize + sizeof(uint64_t)));
+  if (producer->ring == NULL) {
+    free(producer);
+    return NULL;
+  }
+  producer->logger = logger;
+  producer->records = records;
+  producer->head = 0;
+  producer->tail = 0;
+  producer->busy = false;
+  pthread_mutex_lock(&logger->drainLock);
+  int count = 0;
+  log_producer_t *attached;
+  for (attached = logger->producers; attached; attached = attached->next)
+    count++;
+  if (count >= log_kMaxProducers) {
+    pthread_mutex_unlock(&logger->drainLock);
+    free(producer->ring);
+    free(producer);
+    return NULL;
+  }
+  producer->next = logger->producers;
+  logger->producers = producer;
+  pthread_mutex_unlock(&logger->drainLock);
+  return producer;
+}
+
+// commit a record from a producer thread, lock free unless this commit
+// has to drain the rings (minute roll over or a full ring)
+uint64_t log_commitFrom(log_producer_t *producer, void *data) {
+  log_t *logger = producer->logger;
+  uint32_t head = producer->head;
+  uint64_t stamp;
+  while (true) {
+    __atomic_store_n(&producer->busy, true, __ATOMIC_SEQ_CST);
+    struct timespec ts;
+    readClock(logger, &ts);
+    stamp = epochStamp(logger, &ts);
+    if (ringCount(producer, head,
+                  __atomic_load_n(&producer->tail, __ATOMIC_ACQUIRE)) <
+        producer->records)
+      break;
+    // ring full, drain up to now ourselves rather than drop the record, then
+    // take a fresh timestamp as the drain may have written newer records
+    __atomic_store_n(&producer->busy, false, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&logger->drainLock);
+    drainProducers(logger, stamp + 1);
+    pthread_mutex_unlock(&logger->drainLock);
+  }
+  unsigned char *record = ringRecord(producer, head);
+  memcpy(record, &stamp, sizeof(stamp));
+  memcpy(record + sizeof(stamp), data, logger->dataSize);
+  __atomic_store_n(&producer->head, (head + 1) % (2 * producer->records),
+                   __ATOMIC_RELEASE);
+  __atomic_store_n(&producer->busy, false, __ATOMIC_SEQ_CST);
+
+  // first commit of a new minute writes out everything before it, any
+  // other producer arriving meanwhile carries on
+  uint64_t perMinute = 60 * stampsPerSecond(logger);
+  int64_t minute = (int64_t)(stamp / perMinute);
+  if (minute > __atomic_load_n(&logger->drainMinute, __ATOMIC_RELAXED)) {
+    if (pthread_mutex_trylock(&logger->drainLock) == 0) {
+      if (minute > logger->drainMinute) {
+        drainProducers(logger, (uint64_t)minute * perMinute);
+        __atomic_store_n(&logger->drainMinute, minute, __ATOMIC_RELAXED);
+      }
+      pthread_mutex_unlock(&logger->drainLock);
     }
   }
-  return bytesRead;
+  return stamp;
 }
 
-// read the log record later than tv and earlier than now
-int log_read(log_t *logger, struct timespec *ts, void *data) {
-  // fileName(ts->tv_sec);
-  // usleep(10000);
+// drain and remove a producer, no further commits may be made through it
+void log_detach(log_producer_t *producer) {
+  log_t *logger = producer->logger;
+  struct timespec ts;
+  readClock(logger, &ts);
+  uint64_t stamp = epochStamp(logger, &ts);
+  pthread_mutex_lock(&logger->drainLock);
+  drainProducers(logger, stamp + 1);
+  log_producer_t **link = &logger->producers;
+  while (*link != producer)
+    link = &(*link)->next;
+  *link = producer->next;
+  pthread_mutex_unlock(&logger->drainLock);
+  free(producer->ring);
+  free(producer);
+}
 
-  if (logger->fileTime != secondsToHour(ts->tv_sec)) {
-    if (getFileBuffer(logger, ts) == 0) { // get new file
-      return 0;
+// frame a block of records stamped by the caller, of sizes bytes each or
+// dataSize when sizes is NULL, records out of range are skipped
+static uint64_t commitFrames(log_t *logger, const struct timespec *ts,
+                             const void *records, const int *sizes,
+                             size_t count) {
+  if (count == 0)
+    return 0;
+  const unsigned char *data = (const unsigned char *)records;
+  if ((ts[0].tv_sec < logger->minuteStart) ||
+      (ts[0].tv_sec >= logger->minuteStart + 60))
+    writeToDisk(logger);
+  size_t index;
+  size_t appended = 0;
+  uint64_t stamp = 0;
+  for (index = 0; index < count; index++) {
+    int size = sizes != NULL ? sizes[index] : logger->dataSize;
+    if ((size < 0) || (size > logger->dataSize)) {
+      fprintf(stderr, "Error : Log Record Size Invalid\n");
+      continue;
     }
+    stamp = epochStamp(logger, (struct timespec *)&ts[index]);
+    appendFrame(logger, startRecord(logger, stamp), data, size);
+    journalCommit(logger, stampMillis(logger, stamp), 1);
+    data += size;
+    appended++;
+  }
+  if (logger->fileIndex != 0)
+    setFileTime(logger, ts[count - 1].tv_sec);
+  stats_add(&logger->stats.records, appended);
+  return stamp;
+}
 
-    // fprintf(stdout, "New file opened 1\n");
+// as log_commitBatch for a logger opened with variable set, the records
+// are packed back to back, sizes holding the bytes of each
+uint64_t log_commitSizes(log_t *logger, const struct timespec *ts,
+                         const void *records, const int *sizes,
+                         size_t count) {
+  if (!logger->variable) {
+    fprintf(stderr, "Error : Log Record Size Invalid\n");
+    return 0;
   }
+  return commitFrames(logger, ts, records, sizes, count);
+}
 
-  while (millisFromHour(ts) >=
-         ntohl(*(uint32_t *)&logger->fileBuffer[logger->fileIndex])) {
-    logger->fileIndex += logger->dataSize + sizeof(uint32_t);
-    if (logger->fileIndex >= logger->fileSize) {
-      if (nextHour(ts) == false) {
-        return 0;
-      }
-      if (getFileBuffer(logger, ts) == 0) { // get new file
-        return 0;
-      }
+// append a block of records stamped by the caller (one timespec per record,
+// in time order), hour boundaries are computed once per hour spanned, each
+// record of a logger using sources is its big endian source id then data
+uint64_t log_commitBatch(log_t *logger, const struct timespec *ts,
+                         const void *records, size_t count) {
+  if (logger->variable)
+    return commitFrames(logger, ts, records, NULL, count);
+  if ((count == 0) || !takeBuffer(logger))
+    return 0;
+  const unsigned char *data = (const unsigned char *)records;
+  int logRecordSize = logger->recordSize;
+  if ((ts[0].tv_sec < logger->minuteStart) ||
+      (ts[0].tv_sec >= logger->minuteStart + 60))
+    writeToDisk(logger);
+
+  size_t index = 0;
+  while (index < count) {
+    time_t hour = ts[index].tv_sec - ts[index].tv_sec % 3600;
+    uint64_t first = log_millis((struct timespec *)&ts[index]);
+    if ((logger->fileIndex != 0) && (hour != logger->hourStart))
+      writeToDisk(logger);
+    else if ((logger->fileIndex != 0) && (first >= logger->flushDue))
+      flushEarly(logger, &logger->stats.counters.timedFlushes);
+    int space = (logger->flushBytes - logger->fileIndex) / logRecordSize;
+    if ((space <= 0) && !makeRoom(logger, logRecordSize)) {
+      // nothing fits, the rest of the batch is dropped
+      stats_add(&logger->stats.counters.droppedNewest, count - index - 1);
+      break;
+    }
+    space = (logger->flushBytes - logger->fileIndex) / logRecordSize;
+    if (space <= 0) // not written out yet, fill on to the buffer's end
+      space = (logger->bufferSize - logger->fileIndex) / logRecordSize;
+    if ((logger->fileIndex == 0) && (logger->flushMillis != 0))
+      logger->flushDue = first + logger->flushMillis;
+    // copy the run of records in this hour that fits in the buffer
+    unsigned char *record = &logger->buffer[logger->fileIndex];
+    size_t runStart = index;
+    time_t hourEnd = hour + 3600;
+    while ((index < count) && (space-- > 0) && (ts[index].tv_sec >= hour) &&
+           (ts[index].tv_sec < hourEnd)) {
+      *(uint32_t *)record = htonl(stampFrom(logger, &ts[index], hour));
+      memcpy(record + sizeof(uint32_t),
+             &data[index * (logRecordSize - sizeof(uint32_t))],
+             logRecordSize - sizeof(uint32_t));
+      record += logRecordSize;
+      index++;
+    }
+    logger->fileIndex = record - logger->buffer;
+    if (index > runStart)
+      setFileTime(logger, ts[index - 1].tv_sec);
+    if (publishOnCommit(logger) && (index > runStart))
+      publishLive(logger, record - (index - runStart) * logRecordSize,
+                  (int)(index - runStart));
+    journalCommit(logger, log_millis((struct timespec *)&ts[index - 1]),
+                  (int)(index - runStart));
+    stats_add(&logger->stats.records, index - runStart);
+  }
+  return epochStamp(logger, (struct timespec *)&ts[count - 1]);
+}
+
+// copy the flush policy counters
+void log_counters(log_t *logger, log_counters_t *counters) {
+  const uint64_t *totals = (const uint64_t *)&logger->stats.counters;
+  uint64_t *copy = (uint64_t *)counters;
+  size_t index;
+  for (index = 0; index < sizeof(log_counters_t) / sizeof(uint64_t); index++)
+    copy[index] = __atomic_load_n(&totals[index], __ATOMIC_RELAXED);
+}
 
-      // fprintf(stdout, "New file opened 2\n");
+void log_end(log_t *logger) {
+  if (logger->producers != NULL) {
+    // producers have stopped, write out everything left in their rings
+    pthread_mutex_lock(&logger->drainLock);
+    drainProducers(logger, UINT64_MAX);
+    pthread_mutex_unlock(&logger->drainLock);
+    while (logger->producers != NULL) {
+      log_producer_t *producer = logger->producers;
+      logger->producers = producer->next;
+      free(producer->ring);
+      free(producer);
     }
   }
+  if (logger->fileIndex != 0) {
+    writeToDisk(logger);
+  }
+  if (logger->async) {
+    // let the flush thread drain the last buffer, then stop it
+    pthread_mutex_lock(&logger->flushLock);
+    logger->stop = true;
+    pthread_cond_signal(&logger->flushReady);
+    pthread_mutex_unlock(&logger->flushLock);
+    pthread_join(logger->flushThread, NULL);
+    pthread_cond_destroy(&logger->flushDone);
+    pthread_cond_destroy(&logger->flushReady);
+    pthread_mutex_destroy(&logger->flushLock);
+    if (logger->journal == NULL)
+      pool_put(logger->flushBuffer, logger->bufferSize);
+    logger->flushBuffer = NULL;
+    logger->async = false;
+  }
+  closeHourFile(logger);
+  logger->writeDay = 0;
+  // everything committed is on disk now, readers tailing the ring go there
+  if (logger->live != NULL)
+    live_close(logger->live, true);
+  logger->live = NULL;
+  if (logger->follow != NULL)
+    live_close(logger->follow, false);
+  logger->follow = NULL;
+  if (logger->journal != NULL) {
+    closeJournal(logger);
+  } else {
+    // records a failed last write left behind have nowhere to go
+    if (logger->buffer != NULL)
+      stats_add(&logger->stats.counters.lostRecords,
+                bufferRecords(logger, logger->buffer, logger->fileIndex));
+    pool_put(logger->buffer, logger->bufferSize);
+  }
+  logger->buffer = NULL;
+  pool_put(logger->window, logger->windowSize);
+  logger->window = NULL;
+  cache_release(logger->cached);
+  logger->cached = NULL;
+  logger->readBuffer = NULL;
+  logger->fileSize = 0;
+  if (logger->mapping != NULL) {
+    munmap(logger->mapping, logger->mappingSize);
+    logger->mapping = NULL;
+  }
+  free(logger->encodeBuffer);
+  logger->encodeBuffer = NULL;
+  logger->compress = false;
+  free(logger->decodeBuffer);
+  logger->decodeBuffer = NULL;
+  logger->decodeCapacity = 0;
+  free(logger->statsPath);
+  logger->statsPath = NULL;
+  if (logger->compacting)
+    pthread_join(logger->compactThread, NULL);
+  logger->compacting = false;
+  if (logger->archive != NULL) {
+    archive_close(logger->archive);
+    free(logger->archive);
+    logger->archive = NULL;
+  }
+  free(logger->skips);
+  logger->skips = NULL;
+  logger->skipCount = 0;
+  logger->skipCapacity = 0;
+  pthread_mutex_destroy(&logger->drainLock);
+  pthread_mutex_destroy(&logger->statsLock);
+}
 
-  uint32_t recordMillisFromHour =
-      ntohl(*(uint32_t *)&logger->fileBuffer[logger->fileIndex]);
-  time_t recordSecondsToHour = secondsToHour(ts->tv_sec);
+// free the buffers pooled for reuse by loggers that have ended, and the
+// cached hours no reader holds
+void log_trim(void) {
+  pool_trim();
+  cache_trim();
+}
 
-  ts->tv_sec = recordSecondsToHour + ((time_t)recordMillisFromHour / 1000LL);
-  ts->tv_nsec = ((uint32_t)recordMillisFromHour % 1000LL) * 1000000LL;
+// bound the process wide cache of decoded hours shared by readers, hours
+// larger than a quarter of bytes are read without it, 0 turns it off
+void log_setCacheSize(size_t bytes) { cache_setSize(bytes); }
 
-  memcpy(data, &logger->fileBuffer[logger->fileIndex] + sizeof(uint32_t),
-         logger->dataSize); // copy the new log data
-  return logger->dataSize;
+bool nextHour(log_t *logger, struct timespec *ts) {
+  ts->tv_sec = secondsToHour(ts->tv_sec) + 3600LL;
+  ts->tv_nsec = 0;
+  struct timespec now;
+  readClock(logger, &now);
+  return (ts->tv_sec < now.tv_sec);
+}
+
+// bit mask of the numbered entries ("07" or "07.dat") in a directory, bit n
+// set for entry n, archives ("07.ach") set bit n of archives instead when
+// it is not NULL, zero when the directory does not exist
+static uint32_t listDirectory(const char *path, uint32_t *archives) {
+  if (archives != NULL)
+    *archives = 0;
+  DIR *dir = opendir(path);
+  if (dir == NULL)
+    return 0;
+  uint32_t mask = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    char *end;
+    long number = strtol(entry->d_name, &end, 10);
+    if ((end == entry->d_name) || (number < 0) || (number >= 32))
+      continue;
+    if ((*end == '\0') || (strcmp(end, ".dat") == 0))
+      mask |= 1UL << number;
+    else if ((archives != NULL) && (strcmp(end, ".ach") == 0))
+      *archives |= 1UL << number;
+  }
+  closedir(dir);
+  return mask;
+}
+
+// directory listings kept while walking forward through the hour files of
+// one read or query, each directory is listed at most once, hours packed
+// into an archive are taken from it rather than from any loose hour file
+typedef struct {
+  long firstYear; // range of year directories
+  long lastYear;
+  long year;
+  int month;
+  time_t day;
+  uint32_t months;        // bit n set for month n
+  uint32_t monthArchives; // bit n set when month n is in YYYY/MM.ach
+  uint32_t days;          // bit n set for day of month n
+  uint32_t dayArchives;   // bit n set when day n is in YYYY/MM/DD.ach
+  uint32_t packedDays;    // bit n set for days held by the month archive
+  uint32_t hours;         // bit n set for hour n
+  uint32_t archived;      // bit n set when hour n is read from archive
+  index_hour_t manifest[24];
+  archive_t *archive; // archive of the day walked, own or the logger's
+  archive_t own;
+} hourWalk_t;
+
+static void beginWalk(log_t *logger, hourWalk_t *walk) {
+  walk->firstYear = LONG_MAX;
+  walk->lastYear = -1;
+  DIR *dir = opendir(logger->basePath[0] ? logger->basePath : ".");
+  if (dir != NULL) {
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+      char *end;
+      long year = strtol(entry->d_name, &end, 10);
+      if ((end != entry->d_name) && (*end == '\0')) {
+        if (year < walk->firstYear)
+          walk->firstYear = year;
+        if (year > walk->lastYear)
+          walk->lastYear = year;
+      }
+    }
+    closedir(dir);
+  }
+  walk->year = -1;
+  walk->month = -1;
+  walk->day = -1;
+  archive_init(&walk->own);
+  walk->archive = &walk->own;
+}
+
+static void endWalk(hourWalk_t *walk) { archive_close(&walk->own); }
+
+// walk with the archive kept by the logger for its cursor, so reading on
+// through an archive opens it once
+static void beginCursorWalk(log_t *logger, hourWalk_t *walk) {
+  beginWalk(logger, walk);
+  if (logger->archive == NULL) {
+    logger->archive = malloc(sizeof(archive_t));
+    if (logger->archive != NULL)
+      archive_init(logger->archive);
+  }
+  if (logger->archive != NULL)
+    walk->archive = logger->archive;
+}
+
+// take the summaries of the hours of the day from dayStart from the open
+// archive
+static void archivedDay(hourWalk_t *walk, time_t dayStart) {
+  const archive_t *archive = walk->archive;
+  int index;
+  for (index = 0; index < archive->count; index++) {
+    time_t hour = archive->hours[index].hour;
+    if ((hour < dayStart) || (hour >= dayStart + 86400))
+      continue;
+    int number = (int)((hour - dayStart) / 3600);
+    walk->manifest[number] = archive->hours[index].summary;
+    walk->hours |= 1UL << number;
+    walk->archived |= 1UL << number;
+  }
+}
+
+// list the hours of a day, archived ones first
+static void walkDay(log_t *logger, hourWalk_t *walk, struct tm *tm,
+                    time_t dayStart) {
+  char path[log_kMaxStrLen * 2];
+  long year = 1900L + tm->tm_year;
+  walk->hours = 0;
+  walk->archived = 0;
+  memset(walk->manifest, 0, sizeof(walk->manifest));
+  bool packed = false;
+  if (walk->packedDays & (1UL << tm->tm_mday)) {
+    sprintf(path, "%s%4.4lu/%2.2u.ach", logger->basePath, year,
+            tm->tm_mon + 1);
+    packed = archive_open(walk->archive, path);
+  } else if (walk->dayArchives & (1UL << tm->tm_mday)) {
+    sprintf(path, "%s%4.4lu/%2.2u/%2.2u.ach", logger->basePath, year,
+            tm->tm_mon + 1, tm->tm_mday);
+    packed = archive_open(walk->archive, path);
+  }
+  if (packed)
+    archivedDay(walk, dayStart);
+  if ((walk->days & (1UL << tm->tm_mday)) == 0)
+    return;
+  sprintf(path, "%s%4.4lu/%2.2u/%2.2u", logger->basePath, year,
+          tm->tm_mon + 1, tm->tm_mday);
+  // the listing has the hours, the manifest only their summaries, hours
+  // it misses (legacy days, failed updates) are left unknown
+  uint32_t hours = listDirectory(path, NULL) & ~walk->archived;
+  walk->hours |= hours;
+  index_hour_t loose[24];
+  if ((hours != 0) && index_day(path, loose)) {
+    int hour;
+    for (hour = 0; hour < 24; hour++) {
+      if (hours & (1UL << hour))
+        walk->manifest[hour] = loose[hour];
+    }
+  }
+}
+
+// list the days of the month of tm, those of its day archives and those
+// packed in its month archive, each month once per walk, false when the
+// month holds nothing
+static bool walkMonth(log_t *logger, hourWalk_t *walk, const struct tm *tm) {
+  char path[log_kMaxStrLen * 2];
+  long year = 1900L + tm->tm_year;
+  if (year != walk->year) {
+    sprintf(path, "%s%4.4lu", logger->basePath, year);
+    walk->months = listDirectory(path, &walk->monthArchives);
+    walk->year = year;
+    walk->month = -1;
+  }
+  uint32_t month = 1UL << (tm->tm_mon + 1);
+  if (((walk->months | walk->monthArchives) & month) == 0)
+    return false;
+  if (tm->tm_mon != walk->month) {
+    sprintf(path, "%s%4.4lu/%2.2u", logger->basePath, year, tm->tm_mon + 1);
+    walk->days = 0;
+    walk->dayArchives = 0;
+    if (walk->months & month)
+      walk->days = listDirectory(path, &walk->dayArchives);
+    walk->packedDays = 0;
+    strcat(path, ".ach");
+    if ((walk->monthArchives & month) && archive_open(walk->archive, path)) {
+      int index;
+      for (index = 0; index < walk->archive->count; index++) {
+        struct tm packed;
+        gmtime_r(&walk->archive->hours[index].hour, &packed);
+        walk->packedDays |= 1UL << packed.tm_mday;
+      }
+    }
+    walk->month = tm->tm_mon;
+  }
+  return true;
+}
+
+// a manifest summary holds only while its hour file is the size noted, an
+// hour written since (or when a crash came between the write and the
+// update) is left unknown
+static void checkSummary(log_t *logger, time_t hour, index_hour_t *summary) {
+  char filePath[log_kMaxStrLen * 2];
+  struct stat sb;
+  if (summary->count == 0)
+    return;
+  hourPath(logger, hour, filePath);
+  if ((stat(filePath, &sb) != 0) || ((uint64_t)sb.st_size != summary->bytes))
+    memset(summary, 0, sizeof(index_hour_t));
+}
+
+// start of the first hour in [from, until) that has a data file, zero when
+// there is none, walks the year / month / day directories so missing days
+// cost one directory listing rather than 24 failed opens, summary is
+// filled from the day's archive or manifest when it has the hour, see
+// checkSummary
+static time_t findHour(log_t *logger, hourWalk_t *walk, time_t from,
+                       time_t until, index_hour_t *summary) {
+  time_t t = from - from % 3600;
+  while (t < until) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    long year = 1900L + tm.tm_year;
+    if (year > walk->lastYear)
+      return 0;
+    if (year < walk->firstYear) {
+      memset(&tm, 0, sizeof(tm)); // start of the first year logged
+      tm.tm_year = walk->firstYear - 1900L;
+      tm.tm_mday = 1;
+      t = timegm(&tm);
+      continue;
+    }
+    if (!walkMonth(logger, walk, &tm)) {
+      tm.tm_mon++; // start of next month
+      tm.tm_mday = 1;
+      tm.tm_hour = 0;
+      tm.tm_min = 0;
+      tm.tm_sec = 0;
+      t = timegm(&tm);
+      continue;
+    }
+    time_t dayStart = t - t % 86400;
+    if ((walk->days | walk->dayArchives | walk->packedDays) &
+        (1UL << tm.tm_mday)) {
+      if (dayStart != walk->day) {
+        walkDay(logger, walk, &tm, dayStart);
+        walk->day = dayStart;
+      }
+      uint32_t hours = walk->hours & ~((1UL << tm.tm_hour) - 1);
+      if (hours != 0) {
+        int hour = __builtin_ctz(hours);
+        if (dayStart + (time_t)hour * 3600 >= until)
+          return 0;
+        if (summary != NULL) {
+          *summary = walk->manifest[hour];
+          if ((walk->archived & (1UL << hour)) == 0)
+            checkSummary(logger, dayStart + (time_t)hour * 3600, summary);
+        }
+        return dayStart + (time_t)hour * 3600;
+      }
+    }
+    t = dayStart + 86400;
+  }
+  return 0;
+}
+
+// start of the last hour before until that has a data file, zero when
+// there is none, walks the directories backwards as findHour walks forwards
+static time_t findLastHour(log_t *logger, hourWalk_t *walk, time_t until) {
+  time_t t = until - 1;
+  while (true) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    long year = 1900L + tm.tm_year;
+    if (year < walk->firstYear)
+      return 0;
+    if (year > walk->lastYear) {
+      memset(&tm, 0, sizeof(tm)); // end of the last year logged
+      tm.tm_year = walk->lastYear + 1 - 1900L;
+      tm.tm_mday = 1;
+      t = timegm(&tm) - 1;
+      continue;
+    }
+    if (!walkMonth(logger, walk, &tm)) {
+      tm.tm_mday = 1; // end of previous month
+      tm.tm_hour = 0;
+      tm.tm_min = 0;
+      tm.tm_sec = 0;
+      t = timegm(&tm) - 1;
+      continue;
+    }
+    time_t dayStart = t - t % 86400;
+    if ((walk->days | walk->dayArchives | walk->packedDays) &
+        (1UL << tm.tm_mday)) {
+      if (dayStart != walk->day) {
+        walkDay(logger, walk, &tm, dayStart);
+        walk->day = dayStart;
+      }
+      uint32_t hours = walk->hours & ((2UL << tm.tm_hour) - 1);
+      if (hours != 0)
+        return dayStart + (time_t)(31 - __builtin_clz(hours)) * 3600;
+    }
+    t = dayStart - 1;
+  }
+}
+
+// open the file holding hour, its archive when the walk finds the hour
+// packed, offset and size give the hour's bytes in the file, -1 when there
+// is no such file
+static int openHour(log_t *logger, hourWalk_t *walk, time_t hour,
+                    off_t *offset, size_t *size) {
+  time_t dayStart = hour - hour % 86400;
+  if (walk->day != dayStart)
+    findHour(logger, walk, hour, hour + 3600, NULL);
+  *offset = 0;
+  *size = 0;
+  if ((walk->day == dayStart) &&
+      (walk->archived & (1UL << ((hour - dayStart) / 3600)))) {
+    const archive_hour_t *packed = archive_find(walk->archive, hour);
+    if (packed != NULL) {
+      *offset = (off_t)packed->offset;
+      *size = (size_t)packed->size;
+      return dup(walk->archive->fd);
+    }
+  }
+  char filePath[log_kMaxStrLen * 2];
+  hourPath(logger, hour, filePath);
+  int fd = open(filePath, O_RDONLY);
+  struct stat sb;
+  if ((fd >= 0) && (fstat(fd, &sb) == 0))
+    *size = sb.st_size;
+  return fd;
+}
+
+// map size bytes at offset of a file read only, from the page holding
+// offset, data is set to the bytes at offset, NULL when empty or it cannot
+// be mapped, unmap with mappedSize
+static void *mapSpan(int fd, off_t offset, size_t size, size_t *mappedSize,
+                     const unsigned char **data) {
+  if (size == 0)
+    return NULL;
+  off_t start = offset - offset % sysconf(_SC_PAGESIZE);
+  size_t length = size + (size_t)(offset - start);
+  void *mapping = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, start);
+  if (mapping == MAP_FAILED)
+    return NULL;
+  madvise(mapping, length, MADV_SEQUENTIAL);
+  *mappedSize = length;
+  *data = (const unsigned char *)mapping + (offset - start);
+  return mapping;
+}
+
+// map the hour's bytes, no size limit and no copy, return bytes mapped
+static int mapBuffer(log_t *logger, int fd, off_t offset, size_t size) {
+  logger->mapping =
+      mapSpan(fd, offset, size, &logger->mappingSize, &logger->readBuffer);
+  if (logger->mapping == NULL)
+    return 0;
+  return size > INT_MAX ? INT_MAX : (int)size;
+}
+
+// decode compressed blocks into a buffer grown as needed, returns bytes
+static size_t decodeBlocks(const unsigned char *data, size_t size,
+                           unsigned char **buffer, size_t *capacity) {
+  size_t decodedSize = codec_decodedSize(data, size);
+  if (decodedSize > *capacity) {
+    unsigned char *grown = realloc(*buffer, decodedSize);
+    if (grown == NULL)
+      return 0;
+    *buffer = grown;
+    *capacity = decodedSize;
+  }
+  return codec_decode(data, size, *buffer);
+}
+
+// add a skip entry for the variable size frame at buffer index
+static void addSkip(log_t *logger, uint32_t millis, int index) {
+  if (logger->skipCount == logger->skipCapacity) {
+    int capacity = logger->skipCapacity > 0 ? logger->skipCapacity * 2 : 64;
+    uint32_t *grown =
+        realloc(logger->skips, (size_t)capacity * 2 * sizeof(uint32_t));
+    if (grown == NULL)
+      return; // searches scan further
+    logger->skips = grown;
+    logger->skipCapacity = capacity;
+  }
+  logger->skips[logger->skipCount * 2] = millis;
+  logger->skips[logger->skipCount * 2 + 1] = (uint32_t)index;
+  logger->skipCount++;
+}
+
+// list the buffer index of every index_kInterval'th frame of the variable
+// size hour just loaded, taking those its hour index holds that match the
+// data and scanning for the rest, and cut a partly written last frame
+static void frameHour(log_t *logger) {
+  logger->skipCount = 0;
+  if (logger->fileSize == 0)
+    return;
+  struct tm tm;
+  char directory[log_kMaxStrLen * 2];
+  gmtime_r(&logger->fileTime, &tm);
+  sprintf(directory, "%s%4.4lu/%2.2u/%2.2u", logger->basePath,
+          1900L + tm.tm_year, tm.tm_mon + 1, tm.tm_mday);
+  const unsigned char *records = logger->readBuffer;
+  uint32_t size;
+  int count = 0;
+  uint32_t *entries = index_entries(directory, tm.tm_hour, &count);
+  int entry;
+  for (entry = 0; entry < count; entry++) {
+    uint32_t millis = entries[entry * 2];
+    uint32_t index = entries[entry * 2 + 1];
+    if ((entry == 0 ? index != 0 : index <= entries[entry * 2 - 1]) ||
+        (index >= (uint32_t)logger->fileSize) ||
+        (frame_size(&records[index], logger->fileSize - index, &size) == 0) ||
+        (ntohl(*(uint32_t *)&records[index]) != millis))
+      break; // stale, or ahead of the data read
+    addSkip(logger, millis, (int)index);
+  }
+  free(entries);
+  // scan on from the last entry taken
+  int frames = 0;
+  int index = 0;
+  if (logger->skipCount > 0) {
+    logger->skipCount--;
+    frames = logger->skipCount * index_kInterval;
+    index = (int)logger->skips[logger->skipCount * 2 + 1];
+  }
+  while (index < logger->fileSize) {
+    size_t bytes =
+        frame_size(&records[index], logger->fileSize - index, &size);
+    if (bytes == 0)
+      break;
+    if (frames++ % index_kInterval == 0)
+      addSkip(logger, ntohl(*(uint32_t *)&records[index]), index);
+    index += (int)bytes;
+  }
+  logger->fileSize = index;
+}
+
+// read hourly data log file, or its archived copy, into buffer, return
+// bytes read
+int getBuffer(log_t *logger, hourWalk_t *walk, time_t fileTime) {
+  uint64_t start = stats_nanos();
+  logger->fileTime = secondsToHour(fileTime);
+  logger->fileIndex = 0;
+  off_t offset;
+  size_t size;
+  int fd = openHour(logger, walk, logger->fileTime, &offset, &size);
+  if (logger->mapping != NULL) {
+    munmap(logger->mapping, logger->mappingSize);
+    logger->mapping = NULL;
+  }
+  cache_release(logger->cached);
+  logger->cached = NULL;
+  logger->readBuffer = logger->window;
+  logger->fileSize = 0;
+  if (fd < 0) {
+    // no such hour
+  } else if (!logger->mapped &&
+             ((logger->cached = cache_get(fd, offset, size)) != NULL)) {
+    // shared with the other readers of the hour, already decoded
+    logger->readBuffer = logger->cached->records;
+    logger->fileSize = logger->cached->size > INT_MAX
+                           ? INT_MAX
+                           : (int)logger->cached->size;
+    stats_add(&logger->stats.hoursCached, 1);
+  } else {
+    if (!logger->mapped && (logger->window == NULL))
+      logger->window = pool_get(logger->windowSize);
+    logger->readBuffer = logger->window;
+    if (logger->mapped || (logger->window == NULL) ||
+        (size > (size_t)logger->windowSize)) {
+      // hours larger than the window are mapped rather than cut short
+      logger->fileSize = mapBuffer(logger, fd, offset, size);
+    } else {
+      ssize_t bytes = pread(fd, logger->window, size, offset);
+      logger->fileSize = bytes > 0 ? (int)bytes : 0;
+    }
+  }
+  if ((logger->cached == NULL) &&
+      codec_isBlock(logger->readBuffer, logger->fileSize)) {
+    // compressed, decode the whole hour whatever the read mode
+    const unsigned char *data = logger->readBuffer;
+    if (logger->mapping == NULL)
+      logger->mapping = mapSpan(fd, offset, size, &logger->mappingSize, &data);
+    size_t decodedSize = 0;
+    if (logger->mapping != NULL) {
+      decodedSize = decodeBlocks(data, size, &logger->decodeBuffer,
+                                 &logger->decodeCapacity);
+      munmap(logger->mapping, logger->mappingSize);
+      logger->mapping = NULL;
+    }
+    logger->readBuffer = logger->decodeBuffer;
+    logger->fileSize = decodedSize > INT_MAX ? INT_MAX : (int)decodedSize;
+  }
+  if (fd >= 0)
+    close(fd);
+  // ignore a partly written last record
+  int logRecordSize = logger->recordSize;
+  logger->readPrev = -1;
+  if (logger->variable)
+    frameHour(logger);
+  else
+    logger->fileSize -= logger->fileSize % logRecordSize;
+  stats_add(&logger->stats.hoursRead, 1);
+  stats_record(&logger->stats.loadNanos, stats_nanos() - start);
+  return logger->fileSize;
+}
+
+// load the first hour with data at or after ts and before now, moving ts on
+// to the start of that hour when it is a later one
+int getFileBuffer(log_t *logger, struct timespec *ts) {
+  struct timespec now;
+  readClock(logger, &now);
+  hourWalk_t walk;
+  beginCursorWalk(logger, &walk);
+  bool rewalked = false;
+  int bytesRead = 0;
+  while (true) {
+    time_t hour = findHour(logger, &walk, ts->tv_sec, now.tv_sec, NULL);
+    if (hour == 0)
+      break;
+    if (hour != secondsToHour(ts->tv_sec)) {
+      ts->tv_sec = hour;
+      ts->tv_nsec = 0;
+    }
+    bytesRead = getBuffer(logger, &walk, hour);
+    if (bytesRead != 0)
+      break;
+    if (!rewalked && !(walk.archived & (1UL << (hour % 86400 / 3600)))) {
+      // the hour may have been packed into an archive since it was listed
+      endWalk(&walk);
+      beginCursorWalk(logger, &walk);
+      rewalked = true;
+      continue;
+    }
+    ts->tv_sec = hour + 3600; // empty file, try the next
+    ts->tv_nsec = 0;
+  }
+  endWalk(&walk);
+  return bytesRead;
+}
+
+// index of the first of count records later than millis, records are fixed
+// stride and sorted by time so this is a binary search
+static int searchRecords(const unsigned char *records, int count,
+                         int logRecordSize, uint32_t millis) {
+  int low = 0;
+  int high = count;
+  while (low < high) {
+    int middle = low + (high - low) / 2;
+    if (ntohl(*(uint32_t *)&records[middle * logRecordSize]) <= millis)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+static inline uint32_t recordStamp(log_t *logger, int index) {
+  return ntohl(*(uint32_t *)&logger->readBuffer[index]);
+}
+
+// time of a record of the hour being read
+static inline void recordTime(log_t *logger, uint32_t stamp,
+                              struct timespec *ts) {
+  if (logger->resolution == log_kMicros) {
+    ts->tv_sec = logger->fileTime + (time_t)(stamp / 1000000U);
+    ts->tv_nsec = (long)(stamp % 1000000U) * 1000L;
+  } else {
+    ts->tv_sec = logger->fileTime + (time_t)(stamp / 1000U);
+    ts->tv_nsec = (long)(stamp % 1000U) * 1000000L;
+  }
+}
+
+// bytes of the variable size frame at buffer index
+static inline int frameBytes(log_t *logger, int index) {
+  uint32_t size;
+  return (int)frame_size(&logger->readBuffer[index], logger->fileSize - index,
+                         &size);
+}
+
+// data of the record at buffer index, leaving the bytes of a variable size
+// one in readSize
+static inline const unsigned char *recordData(log_t *logger, int index) {
+  const unsigned char *record = &logger->readBuffer[index];
+  if (!logger->variable)
+    return record + logger->recordSize - logger->dataSize;
+  uint32_t size = 0;
+  size_t bytes = frame_size(record, logger->fileSize - index, &size);
+  logger->readSize = (int)size;
+  return record + bytes - size;
+}
+
+// data bytes of the record last read
+static inline int readBytes(log_t *logger) {
+  return logger->variable ? logger->readSize : logger->dataSize;
+}
+
+// buffer index of the first frame later than millis, scanning on from the
+// last skip entry no later than it, noting the frame before in readPrev
+static int searchFrames(log_t *logger, uint32_t millis) {
+  int low = 0;
+  int high = logger->skipCount;
+  while (low < high) {
+    int middle = low + (high - low) / 2;
+    if (logger->skips[middle * 2] <= millis)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  int index = low > 0 ? (int)logger->skips[(low - 1) * 2 + 1] : 0;
+  int previous = -1;
+  while ((index < logger->fileSize) &&
+         (recordStamp(logger, index) <= millis)) {
+    previous = index;
+    index += frameBytes(logger, index);
+  }
+  logger->readPrev = previous;
+  return index;
+}
+
+// buffer index of the frame before the one at index, scanning on from the
+// last skip entry before it
+static int previousFrame(log_t *logger, int index) {
+  int low = 0;
+  int high = logger->skipCount;
+  while (low < high) {
+    int middle = low + (high - low) / 2;
+    if ((int)logger->skips[middle * 2 + 1] < index)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  int at = low > 0 ? (int)logger->skips[(low - 1) * 2 + 1] : 0;
+  while (true) {
+    int next = at + frameBytes(logger, at);
+    if ((next >= index) || (next == at))
+      return at;
+    at = next;
+  }
+}
+
+// buffer index of the record before the cursor, which is past the first
+static int recordBefore(log_t *logger) {
+  if (!logger->variable)
+    return logger->fileIndex - logger->recordSize;
+  if (logger->readPrev < 0)
+    logger->readPrev = previousFrame(logger, logger->fileIndex);
+  return logger->readPrev;
+}
+
+// buffer index of the first record later than millis
+static int searchBuffer(log_t *logger, uint32_t millis) {
+  if (logger->variable)
+    return searchFrames(logger, millis);
+  int logRecordSize = logger->recordSize;
+  return searchRecords(logger->readBuffer, logger->fileSize / logRecordSize,
+                       logRecordSize, millis) *
+         logRecordSize;
+}
+
+// position the read cursor on the first record later than ts, returns
+// false when there is no such record before now
+static bool seekCursor(log_t *logger, struct timespec *ts) {
+  struct timespec seek = *ts;
+  time_t hour = secondsToHour(seek.tv_sec);
+  if (logger->fileTime != hour) {
+    if (getFileBuffer(logger, &seek) == 0)
+      return false;
+    if (logger->fileTime != hour)
+      return true; // first file with data is later, its first record
+  }
+  logger->fileIndex = searchBuffer(logger, stampFromHour(logger, &seek));
+  if (logger->fileIndex < logger->fileSize)
+    return true;
+  // nothing later in this hour, cursor at the start of the next with data
+  if (nextHour(logger, &seek) == false)
+    return false;
+  return getFileBuffer(logger, &seek) != 0;
+}
+
+bool log_seek(log_t *logger, struct timespec *ts) {
+  uint64_t start = stats_nanos();
+  bool found = seekCursor(logger, ts);
+  stats_record(&logger->stats.seekNanos, stats_nanos() - start);
+  return found;
+}
+
+// load the next hour with data after the one under the cursor
+static bool nextBuffer(log_t *logger) {
+  struct timespec next = {logger->fileTime, 0};
+  if (nextHour(logger, &next) == false)
+    return false;
+  return getFileBuffer(logger, &next) != 0; // get new file
+}
+
+// return the record data at the cursor and advance past it, the pointer
+// stays valid until the cursor moves to another hour, the bytes of a
+// variable size record are left in readSize
+const void *log_nextPtr(log_t *logger, struct timespec *ts) {
+  if (logger->fileTime == 0)
+    return NULL; // not positioned by log_seek
+  if ((logger->fileIndex >= logger->fileSize) && !nextBuffer(logger))
+    return NULL;
+  recordTime(logger, recordStamp(logger, logger->fileIndex), ts);
+  const unsigned char *data = recordData(logger, logger->fileIndex);
+  logger->readPrev = logger->fileIndex;
+  if (logger->variable)
+    logger->fileIndex = (int)(data - logger->readBuffer) + logger->readSize;
+  else
+    logger->fileIndex += logger->recordSize;
+  return data;
+}
+
+// read the record at the cursor and advance past it
+int log_next(log_t *logger, struct timespec *ts, void *data) {
+  const void *record = log_nextPtr(logger, ts);
+  if (record == NULL)
+    return 0;
+  memcpy(data, record, readBytes(logger)); // copy the new log data
+  return readBytes(logger);
+}
+
+// put the cursor on the first record later than ts
+static bool positionCursor(log_t *logger, struct timespec *ts) {
+  // sequential reads pass back the last record time, where the cursor
+  // already sits between that record and the next
+  bool positioned = false;
+  if (logger->fileTime == secondsToHour(ts->tv_sec)) {
+    uint32_t millis = stampFromHour(logger, ts);
+    positioned =
+        ((logger->fileIndex == 0) ||
+         (recordStamp(logger, recordBefore(logger)) <= millis)) &&
+        ((logger->fileIndex >= logger->fileSize) ||
+         (recordStamp(logger, logger->fileIndex) > millis));
+  }
+  return positioned || log_seek(logger, ts);
+}
+
+// read the log record later than tv and earlier than now
+const void *log_readPtr(log_t *logger, struct timespec *ts) {
+  if (!positionCursor(logger, ts))
+    return NULL;
+  return log_nextPtr(logger, ts);
+}
+
+int log_read(log_t *logger, struct timespec *ts, void *data) {
+  uint64_t start = logger->timing ? stats_nanos() : 0;
+  const void *record = log_readPtr(logger, ts);
+  if (logger->timing)
+    stats_record(&logger->stats.seekNanos, stats_nanos() - start);
+  if (record == NULL)
+    return 0;
+  memcpy(data, record, readBytes(logger)); // copy the new log data
+  return readBytes(logger);
+}
+
+// load the last hour with data before until, with the cursor after its
+// last record, returns bytes read
+static int getLastFileBuffer(log_t *logger, time_t until) {
+  hourWalk_t walk;
+  beginCursorWalk(logger, &walk);
+  bool rewalked = false;
+  int bytesRead = 0;
+  while (true) {
+    time_t hour = findLastHour(logger, &walk, until);
+    if (hour == 0)
+      break;
+    bytesRead = getBuffer(logger, &walk, hour);
+    if (bytesRead != 0) {
+      logger->fileIndex = bytesRead;
+      logger->readPrev = -1;
+      break;
+    }
+    if (!rewalked && !(walk.archived & (1UL << (hour % 86400 / 3600)))) {
+      // the hour may have been packed into an archive since it was listed
+      endWalk(&walk);
+      beginCursorWalk(logger, &walk);
+      rewalked = true;
+      continue;
+    }
+    until = hour; // empty file, try the one before
+  }
+  endWalk(&walk);
+  return bytesRead;
+}
+
+// position the read cursor after the last record earlier than ts, returns
+// false when there is no such record
+static bool seekBack(log_t *logger, struct timespec *ts) {
+  time_t hour = secondsToHour(ts->tv_sec);
+  if (logger->fileTime != hour) {
+    if (getLastFileBuffer(logger, hour + 3600) == 0)
+      return false;
+    if (logger->fileTime != hour)
+      return true; // last file with data is earlier, after its last record
+  }
+  uint32_t millis = stampFromHour(logger, ts);
+  logger->fileIndex = millis == 0 ? 0 : searchBuffer(logger, millis - 1);
+  if (logger->fileIndex > 0)
+    return true;
+  // nothing earlier in this hour, cursor at the end of the last before it
+  return getLastFileBuffer(logger, hour) != 0;
+}
+
+// step the cursor back over the record before it and return its data, the
+// pointer stays valid until the cursor moves to another hour, log_nextPtr
+// then returns the same record again
+const void *log_prevPtr(log_t *logger, struct timespec *ts) {
+  if (logger->fileTime == 0)
+    return NULL; // not positioned
+  if ((logger->fileIndex == 0) &&
+      (getLastFileBuffer(logger, logger->fileTime) == 0))
+    return NULL;
+  logger->fileIndex = recordBefore(logger);
+  logger->readPrev = -1;
+  recordTime(logger, recordStamp(logger, logger->fileIndex), ts);
+  return recordData(logger, logger->fileIndex);
+}
+
+// put the cursor after the last record earlier than ts
+static bool positionBack(log_t *logger, struct timespec *ts) {
+  // reverse reads pass back the last record time, where the cursor
+  // already sits between the record before and that record
+  bool positioned = false;
+  if (logger->fileTime == secondsToHour(ts->tv_sec)) {
+    uint32_t millis = stampFromHour(logger, ts);
+    positioned =
+        ((logger->fileIndex >= logger->fileSize) ||
+         (recordStamp(logger, logger->fileIndex) >= millis)) &&
+        ((logger->fileIndex == 0) ||
+         (recordStamp(logger, recordBefore(logger)) < millis));
+  }
+  return positioned || seekBack(logger, ts);
+}
+
+// read the log record earlier than ts, the reverse of log_read
+int log_prev(log_t *logger, struct timespec *ts, void *data) {
+  uint64_t start = logger->timing ? stats_nanos() : 0;
+  const void *record =
+      positionBack(logger, ts) ? log_prevPtr(logger, ts) : NULL;
+  if (logger->timing)
+    stats_record(&logger->stats.seekNanos, stats_nanos() - start);
+  if (record == NULL)
+    return 0;
+  memcpy(data, record, readBytes(logger));
+  return readBytes(logger);
+}
+
+// between checks that a live ring is still being written, and between
+// polls of the hour files when there is no ring
+#define kFollowCheckMillis (1000)
+#define kFollowPollMillis (100)
+
+// log_read, reloading the hour under the cursor when it has been read to
+// the end, as a writer may have added to it since
+static int readDisk(log_t *logger, struct timespec *ts, void *data) {
+  if ((logger->fileTime != 0) && (logger->fileIndex >= logger->fileSize))
+    logger->fileTime = 0;
+  return log_read(logger, ts, data);
+}
+
+// copy the first record later than ts from the live ring, or from the hour
+// files while it is older than the ring holds, returns false when there is
+// none yet, head is then the ring's head to wait on
+static bool followRing(log_t *logger, struct timespec *ts, void *data,
+                       uint64_t *head) {
+  live_ring_t *ring = logger->follow;
+  uint64_t millis = epochStamp(logger, ts);
+  uint64_t stamp;
+  while (true) {
+    *head = live_head(ring);
+    uint64_t low = live_tail(ring, *head);
+    uint64_t high = *head;
+    if ((logger->followMillis == millis) && (logger->followNext >= low) &&
+        (logger->followNext <= high)) {
+      low = logger->followNext; // sequential, after the record last read
+    } else {
+      uint64_t oldest = UINT64_MAX;
+      if ((low < high) && !live_read(ring, low, &oldest, NULL))
+        continue; // overrun while reading, start again
+      if (millis < oldest) {
+        // the records after ts may be older than the ring holds
+        struct timespec disk = *ts;
+        if ((readDisk(logger, &disk, data) != 0) &&
+            (epochStamp(logger, &disk) < oldest)) {
+          *ts = disk;
+          return true;
+        }
+        high = low;
+      }
+      while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (!live_read(ring, middle, &stamp, NULL))
+          break;
+        if (stamp <= millis)
+          low = middle + 1;
+        else
+          high = middle;
+      }
+      if (low < high)
+        continue;
+    }
+    if (low == *head)
+      return false;
+    if (!live_read(ring, low, &stamp, data))
+      continue;
+    stampTime(logger, stamp, ts);
+    logger->followNext = low + 1;
+    logger->followMillis = stamp;
+    return true;
+  }
+}
+
+// attach to the live ring of basePath when it has a writer opened with live
+// set, dropping a ring whose writer has ended
+static void attachFollow(log_t *logger) {
+  if (logger->variable)
+    return; // variable size records are never published to a ring
+  if ((logger->follow != NULL) && live_stale(logger->follow)) {
+    live_close(logger->follow, false);
+    logger->follow = NULL;
+  }
+  if (logger->follow == NULL) {
+    char name[64];
+    live_name(logger->basePath[0] != '\0' ? logger->basePath : ".", name,
+              sizeof(name));
+    logger->follow = live_attach(name, logger->dataSize);
+    logger->followNext = 0;
+    logger->followMillis = UINT64_MAX;
+  }
+}
+
+// read the record later than ts as log_read does, waiting up to
+// timeoutMillis (forever when negative) for one to be committed, returns 0
+// when none was. Records still buffered by a writer opened with live set
+// come from its ring and wake the reader as they are committed, older
+// records from the hour files, which are polled when there is no ring
+int log_follow(log_t *logger, struct timespec *ts, void *data,
+               int timeoutMillis) {
+  uint64_t now = stats_nanos();
+  uint64_t deadline =
+      timeoutMillis < 0 ? UINT64_MAX : now + timeoutMillis * 1000000ULL;
+  if ((logger->follow != NULL) &&
+      __atomic_load_n(&logger->follow->header->closed, __ATOMIC_ACQUIRE))
+    attachFollow(logger);
+  while (true) {
+    uint64_t head = 0;
+    int size;
+    if (logger->follow != NULL)
+      size = followRing(logger, ts, data, &head) ? logger->dataSize : 0;
+    else
+      size = readDisk(logger, ts, data);
+    if (size != 0)
+      return size;
+    if (logger->follow == NULL) {
+      attachFollow(logger); // caught up with the hour files
+      if (logger->follow != NULL)
+        continue;
+    }
+    now = stats_nanos();
+    if (now >= deadline)
+      return 0;
+    uint64_t left = (deadline - now + 999999ULL) / 1000000ULL;
+    if (logger->follow != NULL) {
+      live_wait(logger->follow,
+                head, left < kFollowCheckMillis ? (int)left
+                                                : kFollowCheckMillis);
+      if (live_head(logger->follow) == head)
+        attachFollow(logger); // quiet, the writer may have gone
+    } else {
+      int millis = left < kFollowPollMillis ? (int)left : kFollowPollMillis;
+      struct timespec pause = {0, millis * 1000000L};
+      nanosleep(&pause, NULL);
+    }
+  }
+}
+
+// the newest records, at most count of them, oldest first, into data and
+// ts (when not NULL), those a writer opened with live set has not yet
+// written out included, only the newest hours are read, returns records
+// copied
+int log_latest(log_t *logger, int count, struct timespec *ts, void *data) {
+  unsigned char *records = data;
+  int found = 0;
+  uint64_t before = UINT64_MAX; // epoch time of the oldest found
+  if ((logger->follow == NULL) ||
+      __atomic_load_n(&logger->follow->header->closed, __ATOMIC_ACQUIRE))
+    attachFollow(logger);
+  if (logger->follow != NULL) {
+    live_ring_t *ring = logger->follow;
+    uint64_t head = live_head(ring);
+    uint64_t index = head;
+    while ((found < count) && (index > live_tail(ring, head))) {
+      int slot = count - 1 - found;
+      uint64_t millis;
+      if (!live_read(ring, --index, &millis,
+                     &records[slot * logger->dataSize]))
+        break; // the rest have been written out
+      if (ts != NULL)
+        stampTime(logger, millis, &ts[slot]);
+      before = millis;
+      found++;
+    }
+  }
+  struct timespec at;
+  if (before != UINT64_MAX) {
+    stampTime(logger, before, &at);
+  } else {
+    readClock(logger, &at);
+    at.tv_sec++;
+  }
+  if (found < count) {
+    logger->fileTime = 0; // the last hour may have grown, load it again
+    bool positioned = seekBack(logger, &at);
+    while (positioned && (found < count)) {
+      const void *record = log_prevPtr(logger, &at);
+      if (record == NULL)
+        break;
+      int slot = count - 1 - found;
+      memcpy(&records[slot * logger->dataSize], record, readBytes(logger));
+      if (ts != NULL)
+        ts[slot] = at;
+      found++;
+    }
+  }
+  if ((found > 0) && (found < count)) {
+    memmove(records, &records[(count - found) * logger->dataSize],
+            (size_t)found * logger->dataSize);
+    if (ts != NULL)
+      memmove(ts, &ts[count - found], found * sizeof(struct timespec));
+  }
+  return found;
+}
+
+// eight source ids compared at once, GCC vector extensions lower this to
+// SSE / AVX or NEON as the target allows
+typedef uint32_t sourceVector_t __attribute__((vector_size(32)));
+#define kSourceLanes (sizeof(sourceVector_t) / sizeof(uint32_t))
+
+// index of the first of count records whose source is one of filter (ids
+// in network order), count when none match
+static int matchSources(const unsigned char *records, int count,
+                        int logRecordSize, const uint32_t *filter,
+                        int filterCount) {
+  const unsigned char *sources = records + sizeof(uint32_t);
+  sourceVector_t wanted[log_kMaxQuerySources];
+  int query;
+  for (query = 0; query < filterCount; query++) {
+    sourceVector_t id = {0};
+    wanted[query] = id + filter[query];
+  }
+  int index = 0;
+  for (; index + (int)kSourceLanes <= count; index += kSourceLanes) {
+    sourceVector_t ids;
+    unsigned int lane;
+    for (lane = 0; lane < kSourceLanes; lane++) // strided gather
+      ids[lane] =
+          *(const uint32_t *)&sources[(index + lane) * logRecordSize];
+    sourceVector_t hits = {0};
+    for (query = 0; query < filterCount; query++)
+      hits |= (sourceVector_t)(ids == wanted[query]);
+    uint32_t any = 0;
+    for (lane = 0; lane < kSourceLanes; lane++)
+      any |= hits[lane];
+    if (any) {
+      for (lane = 0; hits[lane] == 0; lane++)
+        ;
+      return index + lane;
+    }
+  }
+  for (; index < count; index++) {
+    uint32_t id = *(const uint32_t *)&sources[index * logRecordSize];
+    for (query = 0; query < filterCount; query++) {
+      if (id == filter[query])
+        return index;
+    }
+  }
+  return count;
+}
+
+// read the next record later than ts from one of the count sources, any
+// source when count is zero, data receives the record without its id
+int log_readSource(log_t *logger, struct timespec *ts, const uint32_t *sources,
+                   int count, uint32_t *source, void *data) {
+  if (!logger->sourced || (count > log_kMaxQuerySources))
+    return 0;
+  uint32_t filter[log_kMaxQuerySources];
+  int query;
+  for (query = 0; query < count; query++)
+    filter[query] = htonl(sources[query]);
+  if (!positionCursor(logger, ts))
+    return 0;
+  int logRecordSize = logger->recordSize;
+  uint64_t scanned = 0;
+  while (true) {
+    if ((logger->fileIndex >= logger->fileSize) && !nextBuffer(logger)) {
+      stats_record(&logger->stats.scanRecords, scanned);
+      return 0;
+    }
+    int first = logger->fileIndex / logRecordSize;
+    int total = logger->fileSize / logRecordSize;
+    int match = first;
+    if (count != 0)
+      match += matchSources(&logger->readBuffer[logger->fileIndex],
+                            total - first, logRecordSize, filter, count);
+    logger->fileIndex = match * logRecordSize;
+    scanned += match - first + (match < total);
+    if (match < total)
+      break;
+  }
+  stats_record(&logger->stats.scanRecords, scanned);
+  const unsigned char *record = log_nextPtr(logger, ts);
+  *source = ntohl(*(const uint32_t *)(record - log_kSourceSize));
+  memcpy(data, record, logger->dataSize);
+  return logger->dataSize;
+}
+
+typedef struct {
+  uint32_t *sources;
+  int count;
+  int maxSources;
+} sourceList_t;
+
+static bool collectSources(const log_block_t *block, void *context) {
+  sourceList_t *list = (sourceList_t *)context;
+  uint32_t previous = 0;
+  bool listed = false;
+  int index;
+  for (index = 0; index < block->count; index++) {
+    uint32_t source = ntohl(*(const uint32_t *)&block->records
+                                [index * block->recordSize + sizeof(uint32_t)]);
+    if (listed && (source == previous))
+      continue; // runs from one source are common
+    previous = source;
+    listed = true;
+    int low = 0, high = list->count;
+    while (low < high) {
+      int middle = low + (high - low) / 2;
+      if (list->sources[middle] < source)
+        low = middle + 1;
+      else
+        high = middle;
+    }
+    if ((low < list->count) && (list->sources[low] == source))
+      continue;
+    if (list->count == list->maxSources)
+      return false; // list full
+    memmove(&list->sources[low + 1], &list->sources[low],
+            (list->count - low) * sizeof(uint32_t));
+    list->sources[low] = source;
+    list->count++;
+  }
+  return true;
+}
+
+// list the distinct sources logged in [start, end) in ascending order,
+// returns how many were found, at most maxSources
+int log_listSources(log_t *logger, uint64_t start, uint64_t end,
+                    uint32_t *sources, int maxSources) {
+  if (!logger->sourced)
+    return 0;
+  sourceList_t list = {sources, 0, maxSources};
+  log_query(logger, start, end, collectSources, &list);
+  return list.count;
+}
+
+// true when an indexed hour, its times in units per milli, has no records
+// in [start, end)
+static bool outsideHour(index_hour_t *summary, time_t hour, uint64_t start,
+                        uint64_t end, int unitsPerMilli) {
+  uint64_t hourMillis = (uint64_t)hour * 1000LL;
+  return (summary->count != 0) &&
+         ((hourMillis + summary->last / unitsPerMilli < start) ||
+          (hourMillis + summary->first / unitsPerMilli >= end));
+}
+
+// records of one hour file in [start, end), from the cache or mapped and
+// decoded
+typedef struct {
+  cache_block_t *cached;
+  unsigned char *mapping;
+  size_t size;
+  unsigned char *decoded; // kept across hours, grown as needed
+  size_t decodedCapacity;
+  log_block_t block;
+} hourData_t;
+
+// map the hour's size bytes at offset of fd (which is closed) and find its
+// records, their times in units per milli, in [start, end), false when it
+// cannot be mapped
+static bool loadHour(int fd, off_t offset, size_t size, time_t hour,
+                     uint64_t start, uint64_t end, int logRecordSize,
+                     int unitsPerMilli, hourData_t *data) {
+  data->size = 0;
+  const unsigned char *records = NULL;
+  data->cached = fd < 0 ? NULL : cache_get(fd, offset, size);
+  data->mapping = (fd < 0) || (data->cached != NULL)
+                      ? NULL
+                      : mapSpan(fd, offset, size, &data->size, &records);
+  if (fd >= 0)
+    close(fd);
+  size_t recordsSize = size;
+  if (data->cached != NULL) {
+    records = data->cached->records;
+    recordsSize = data->cached->size;
+  } else if (data->mapping == NULL) {
+    return false;
+  } else if (codec_isBlock(records, size)) {
+    recordsSize =
+        decodeBlocks(records, size, &data->decoded, &data->decodedCapacity);
+    records = data->decoded;
+  }
+  data->block.hour = hour;
+  data->block.recordSize = logRecordSize;
+  data->block.unitsPerMilli = unitsPerMilli;
+  int count = (int)(recordsSize / logRecordSize);
+  uint64_t hourMillis = (uint64_t)hour * 1000LL;
+  int first = 0;
+  if (start > hourMillis)
+    first = searchRecords(records, count, logRecordSize,
+                          (uint32_t)((start - hourMillis) * unitsPerMilli - 1));
+  if (end < hourMillis + 3600000LL)
+    count = searchRecords(records, count, logRecordSize,
+                          (uint32_t)((end - hourMillis) * unitsPerMilli - 1));
+  data->block.records = &records[first * logRecordSize];
+  data->block.count = count - first;
+  return true;
+}
+
+static void unloadHour(hourData_t *data) {
+  cache_release(data->cached);
+  data->cached = NULL;
+  if (data->mapping != NULL)
+    munmap(data->mapping, data->size);
+  data->mapping = NULL;
+}
+
+// next hour at or after from with data in [start, end), 0 when none
+static time_t nextQueryHour(log_t *logger, hourWalk_t *walk, time_t from,
+                            uint64_t start, uint64_t end) {
+  time_t until = (time_t)(end / 1000LL + (end % 1000LL != 0));
+  index_hour_t summary;
+  time_t hour = findHour(logger, walk, from, until, &summary);
+  // the manifest tells which edge hours hold nothing in range
+  while ((hour != 0) && outsideHour(&summary, hour, start, end,
+                                    (int)(stampsPerSecond(logger) / 1000)))
+    hour = findHour(logger, walk, hour + 3600, until, &summary);
+  return hour;
+}
+
+// stream the records in [start, end), epoch millis, to callback as one
+// block per hour file, only hours that exist are opened and the next file
+// is read ahead while the current one is processed, returns records sent,
+// -1 for a logger opened with variable set as blocks are of fixed records
+long log_query(log_t *logger, uint64_t start, uint64_t end,
+               log_callback_t callback, void *context) {
+  if (logger->variable)
+    return -1;
+  int logRecordSize = logger->recordSize;
+  hourWalk_t walk;
+  beginWalk(logger, &walk);
+  time_t hour =
+      nextQueryHour(logger, &walk, (time_t)(start / 1000LL), start, end);
+  int fd = -1;
+  off_t offset = 0;
+  size_t size = 0;
+  if (hour != 0)
+    fd = openHour(logger, &walk, hour, &offset, &size);
+  hourData_t data = {0};
+  long total = 0;
+  while (hour != 0) {
+    time_t following = nextQueryHour(logger, &walk, hour + 3600, start, end);
+    int followingFd = -1;
+    off_t followingOffset = 0;
+    size_t followingSize = 0;
+    if (following != 0) {
+      followingFd = openHour(logger, &walk, following, &followingOffset,
+                             &followingSize);
+      if (followingFd >= 0)
+        posix_fadvise(followingFd, followingOffset, followingSize,
+                      POSIX_FADV_WILLNEED);
+    }
+
+    if (loadHour(fd, offset, size, hour, start, end, logRecordSize,
+                 (int)(stampsPerSecond(logger) / 1000), &data)) {
+      bool more = true;
+      if (data.block.count > 0) {
+        total += data.block.count;
+        more = callback(&data.block, context);
+      }
+      unloadHour(&data);
+      if (!more) {
+        if (followingFd >= 0)
+          close(followingFd);
+        break;
+      }
+    }
+    hour = following;
+    fd = followingFd;
+    offset = followingOffset;
+    size = followingSize;
+  }
+  endWalk(&walk);
+  free(data.decoded);
+  stats_record(&logger->stats.scanRecords, total);
+  return total;
+}
+
+// Parallel queries list the hours in range up front, then pool threads
+// claim them in order, each loading its hour into one slot of a ring of
+// twice as many slots as threads and running the worker over it. The
+// calling thread hands the slots to the merge callback in hour order, so
+// no more than the ring's worth of hours is ever held in memory.
+
+typedef enum { kSlotFree, kSlotBusy, kSlotReady } slotState_t;
+
+typedef struct {
+  slotState_t state;
+  long hour; // index into the hour list
+  hourData_t data;
+  bool loaded;
+  unsigned char *result;
+} querySlot_t;
+
+typedef struct {
+  log_t *logger;
+  uint64_t start;
+  uint64_t end;
+  time_t *hours;
+  long hourCount;
+  long claimed;   // hours handed to workers
+  long delivered; // hours handed to merge
+  bool stop;
+  querySlot_t *slots;
+  int slotCount;
+  log_worker_t worker;
+  size_t resultSize;
+  void *context;
+  hourWalk_t walk; // hours are opened in the order claimed, under lock
+  pthread_mutex_t lock;
+  pthread_cond_t slotFreed;
+  pthread_cond_t slotReady;
+} parallelQuery_t;
+
+static void *queryTask(void *argument) {
+  parallelQuery_t *query = (parallelQuery_t *)argument;
+  int logRecordSize = query->logger->recordSize;
+  pthread_mutex_lock(&query->lock);
+  while (true) {
+    while (!query->stop && (query->claimed < query->hourCount) &&
+           (query->claimed >= query->delivered + query->slotCount))
+      pthread_cond_wait(&query->slotFreed, &query->lock);
+    if (query->stop || (query->claimed >= query->hourCount))
+      break;
+    long index = query->claimed++;
+    querySlot_t *slot = &query->slots[index % query->slotCount];
+    slot->state = kSlotBusy;
+    slot->hour = index;
+    off_t offset;
+    size_t size;
+    int fd = openHour(query->logger, &query->walk, query->hours[index],
+                      &offset, &size);
+    pthread_mutex_unlock(&query->lock);
+
+    slot->loaded =
+        loadHour(fd, offset, size, query->hours[index], query->start,
+                 query->end, logRecordSize,
+                 (int)(stampsPerSecond(query->logger) / 1000), &slot->data);
+    if (slot->loaded && (query->worker != NULL)) {
+      memset(slot->result, 0, query->resultSize);
+      query->worker(&slot->data.block, slot->result, query->context);
+    }
+
+    pthread_mutex_lock(&query->lock);
+    slot->state = kSlotReady;
+    pthread_cond_broadcast(&query->slotReady);
+  }
+  pthread_mutex_unlock(&query->lock);
+  return NULL;
+}
+
+// as log_query, but hours are loaded and worked on by a pool of threads
+// (one per core when threads is 0), worker (may be NULL) runs on a pool
+// thread for each hour with resultSize zeroed bytes to fill in, merge gets
+// each hour's block and result in hour order on the calling thread, return
+// false from merge to stop, returns records in range or -1 on failure
+long log_queryParallel(log_t *logger, uint64_t start, uint64_t end,
+                       int threads, log_worker_t worker, size_t resultSize,
+                       log_merge_t merge, void *context) {
+  if (logger->variable)
+    return -1; // as log_query
+  if (threads <= 0)
+    threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads <= 0)
+    threads = 1;
+  parallelQuery_t query = {.logger = logger,
+                           .start = start,
+                           .end = end,
+                           .worker = worker,
+                           .resultSize = resultSize,
+                           .context = context,
+                           .slotCount = 2 * threads};
+  // list the hours in range
+  long capacity = 0;
+  beginWalk(logger, &query.walk);
+  time_t hour =
+      nextQueryHour(logger, &query.walk, (time_t)(start / 1000LL), start, end);
+  while (hour != 0) {
+    if (query.hourCount == capacity) {
+      capacity = capacity ? capacity * 2 : 256;
+      time_t *grown = realloc(query.hours, capacity * sizeof(time_t));
+      if (grown == NULL) {
+        free(query.hours);
+        endWalk(&query.walk);
+        return -1;
+      }
+      query.hours = grown;
+    }
+    query.hours[query.hourCount++] = hour;
+    hour = nextQueryHour(logger, &query.walk, hour + 3600, start, end);
+  }
+  if (query.hourCount == 0) {
+    endWalk(&query.walk);
+    return 0;
+  }
+  if (threads > query.hourCount)
+    threads = (int)query.hourCount;
+
+  query.slots = calloc(query.slotCount, sizeof(querySlot_t));
+  unsigned char *results = calloc(query.slotCount, resultSize ? resultSize : 1);
+  pthread_t *pool = malloc(threads * sizeof(pthread_t));
+  if ((query.slots == NULL) || (results == NULL) || (pool == NULL)) {
+    free(query.slots);
+    free(results);
+    free(pool);
+    free(query.hours);
+    endWalk(&query.walk);
+    return -1;
+  }
+  int slot;
+  for (slot = 0; slot < query.slotCount; slot++)
+    query.slots[slot].result = &results[slot * resultSize];
+  pthread_mutex_init(&query.lock, NULL);
+  pthread_cond_init(&query.slotFreed, NULL);
+  pthread_cond_init(&query.slotReady, NULL);
+  int started;
+  for (started = 0; started < threads; started++)
+    if (pthread_create(&pool[started], NULL, queryTask, &query) != 0)
+      break;
+
+  long total = started > 0 ? 0 : -1;
+  pthread_mutex_lock(&query.lock);
+  while ((started > 0) && (query.delivered < query.hourCount)) {
+    querySlot_t *next = &query.slots[query.delivered % query.slotCount];
+    while ((next->state != kSlotReady) || (next->hour != query.delivered))
+      pthread_cond_wait(&query.slotReady, &query.lock);
+    pthread_mutex_unlock(&query.lock);
+    bool more = true;
+    if (next->loaded && (next->data.block.count > 0)) {
+      total += next->data.block.count;
+      more = merge(&next->data.block, next->result, context);
+    }
+    unloadHour(&next->data);
+    pthread_mutex_lock(&query.lock);
+    next->state = kSlotFree;
+    query.delivered++;
+    if (!more)
+      query.stop = true;
+    pthread_cond_broadcast(&query.slotFreed);
+    if (!more)
+      break;
+  }
+  pthread_mutex_unlock(&query.lock);
+  while (started-- > 0)
+    pthread_join(pool[started], NULL);
+
+  for (slot = 0; slot < query.slotCount; slot++) {
+    unloadHour(&query.slots[slot].data); // hours loaded after a stop
+    free(query.slots[slot].data.decoded);
+  }
+  pthread_cond_destroy(&query.slotReady);
+  pthread_cond_destroy(&query.slotFreed);
+  pthread_mutex_destroy(&query.lock);
+  free(pool);
+  free(results);
+  free(query.slots);
+  free(query.hours);
+  endWalk(&query.walk);
+  if (total > 0)
+    stats_record(&logger->stats.scanRecords, total);
+  return total;
+}
+
+// summarise the hour files overlapping [start, end) from their indexes,
+// hours logged before indexing existed are read for their first and last
+// records, returns false when there is no data
+bool log_extent(log_t *logger, uint64_t start, uint64_t end,
+                log_extent_t *extent) {
+  int logRecordSize = logger->recordSize;
+  time_t until = (time_t)(end / 1000LL + (end % 1000LL != 0));
+  memset(extent, 0, sizeof(log_extent_t));
+  hourWalk_t walk;
+  beginWalk(logger, &walk);
+  index_hour_t summary;
+  time_t hour =
+      findHour(logger, &walk, (time_t)(start / 1000LL), until, &summary);
+  for (; hour != 0;
+       hour = findHour(logger, &walk, hour + 3600, until, &summary)) {
+    if ((summary.count == 0) && logger->variable)
+      continue; // its records can only be counted by reading them all
+    if (summary.count == 0) {
+      char filePath[log_kMaxStrLen * 2];
+      hourPath(logger, hour, filePath);
+      int fd = open(filePath, O_RDONLY);
+      if (fd < 0)
+        continue;
+      struct stat sb;
+      uint32_t first, last;
+      if ((fstat(fd, &sb) == 0) && (sb.st_size >= logRecordSize) &&
+          (pread(fd, &first, sizeof(first), 0) == sizeof(first)) &&
+          (pread(fd, &last, sizeof(last),
+                 sb.st_size - sb.st_size % logRecordSize - logRecordSize) ==
+           sizeof(last))) {
+        summary.count = sb.st_size / logRecordSize;
+        summary.first = ntohl(first);
+        summary.last = ntohl(last);
+      }
+      close(fd);
+      if (summary.count == 0)
+        continue;
+    }
+    uint64_t hourMillis = (uint64_t)hour * 1000LL;
+    if (extent->hours == 0)
+      extent->first = hourMillis + stampMillis(logger, summary.first);
+    extent->last = hourMillis + stampMillis(logger, summary.last);
+    extent->count += summary.count;
+    extent->hours++;
+  }
+  endWalk(&walk);
+  return extent->hours != 0;
+}
+
+// Compaction packs the hour files of closed days, or months, into one
+// archive each, see archive.h, then removes what it packed. An hour found
+// in more than one place, as when a compaction stopped before removing
+// what it packed, is kept once when the copies summarise the same and
+// merged by time otherwise, so records backfilled into a packed day, which
+// readers only see once it is packed again, are kept.
+
+// one copy of an hour to be packed
+typedef struct {
+  int fd;
+  off_t offset;
+  uint64_t size;
+  index_hour_t summary;
+  bool blocks; // compressed
+} hourCopy_t;
+
+// summarise the hour held in size bytes at offset of fd, raw hours are cut
+// to whole records, false when it cannot be read
+static bool summariseHour(int fd, off_t offset, uint64_t size,
+                          int logRecordSize, hourCopy_t *copy) {
+  memset(copy, 0, sizeof(hourCopy_t));
+  copy->fd = fd;
+  copy->offset = offset;
+  const unsigned char *bytes;
+  size_t mappedSize;
+  void *mapping = mapSpan(fd, offset, size, &mappedSize, &bytes);
+  if (mapping == NULL)
+    return size == 0;
+  const unsigned char *records = bytes;
+  size_t recordsSize = size;
+  unsigned char *decoded = NULL;
+  size_t capacity = 0;
+  copy->blocks = codec_isBlock(bytes, size);
+  if (copy->blocks)
+    recordsSize = decodeBlocks(bytes, size, &decoded, &capacity);
+  if (copy->blocks)
+    records = decoded;
+  uint32_t count = recordsSize / logRecordSize;
+  copy->size = copy->blocks ? size : (uint64_t)count * logRecordSize;
+  if (count != 0) {
+    copy->summary.count = count;
+    copy->summary.first = ntohl(*(const uint32_t *)records);
+    copy->summary.last =
+        ntohl(*(const uint32_t *)&records[(count - 1) * logRecordSize]);
+  }
+  free(decoded);
+  munmap(mapping, mappedSize);
+  return true;
+}
+
+// the copy of hour held in an archive
+static void archivedCopy(const archive_t *archive,
+                         const archive_hour_t *packed, hourCopy_t *copy) {
+  unsigned char header[codec_kHeaderSize];
+  copy->fd = archive->fd;
+  copy->offset = (off_t)packed->offset;
+  copy->size = packed->size;
+  copy->summary = packed->summary;
+  copy->blocks = (pread(archive->fd, header, sizeof(header),
+                        copy->offset) == sizeof(header)) &&
+                 codec_isBlock(header, copy->size);
+}
+
+// the records of a copy, decoded when compressed, NULL on failure
+static unsigned char *copyRecords(const hourCopy_t *copy, int logRecordSize,
+                                  uint32_t *count) {
+  const unsigned char *bytes;
+  size_t mappedSize;
+  void *mapping = mapSpan(copy->fd, copy->offset, copy->size, &mappedSize,
+                          &bytes);
+  if (mapping == NULL)
+    return NULL;
+  unsigned char *records = NULL;
+  size_t size = 0, capacity = 0;
+  if (copy->blocks) {
+    size = decodeBlocks(bytes, copy->size, &records, &capacity);
+  } else {
+    records = malloc(copy->size);
+    if (records != NULL)
+      memcpy(records, bytes, copy->size);
+    size = copy->size;
+  }
+  munmap(mapping, mappedSize);
+  *count = size / logRecordSize;
+  return records;
+}
+
+// add hour to writer from its copies, copies that differ are merged by
+// time (compressed when the first is), false on failure
+static bool packHour(archive_writer_t *writer, time_t hour,
+                     const hourCopy_t *copies, int count, int logRecordSize) {
+  const hourCopy_t *distinct[3];
+  int kept = 0;
+  int index;
+  for (index = 0; index < count; index++) {
+    if ((copies[index].summary.count == 0) ||
+        ((kept > 0) && (memcmp(&copies[index].summary, &distinct[0]->summary,
+                               sizeof(index_hour_t)) == 0)))
+      continue; // empty or packed already
+    distinct[kept++] = &copies[index];
+  }
+  if (kept == 0)
+    return true;
+  if (kept == 1)
+    return archive_add(writer, hour, distinct[0]->fd, distinct[0]->offset,
+                       distinct[0]->size, &distinct[0]->summary);
+  unsigned char *records[3] = {NULL};
+  uint32_t counts[3], next[3] = {0}, total = 0;
+  bool done = true;
+  for (index = 0; index < kept; index++) {
+    records[index] = copyRecords(distinct[index], logRecordSize,
+                                 &counts[index]);
+    done = done && (records[index] != NULL);
+    total += records[index] != NULL ? counts[index] : 0;
+  }
+  size_t size = (size_t)total * logRecordSize;
+  unsigned char *merged = done ? malloc(size) : NULL;
+  unsigned char *block = NULL;
+  if (merged != NULL) {
+    uint32_t out;
+    for (out = 0; out < total; out++) {
+      int from = -1;
+      uint32_t millis = 0;
+      for (index = 0; index < kept; index++) {
+        if (next[index] == counts[index])
+          continue;
+        uint32_t at = ntohl(*(const uint32_t *)&records[index]
+                                 [next[index] * logRecordSize]);
+        if ((from < 0) || (at < millis)) {
+          from = index;
+          millis = at;
+        }
+      }
+      memcpy(&merged[(size_t)out * logRecordSize],
+             &records[from][next[from]++ * logRecordSize], logRecordSize);
+    }
+    index_hour_t summary = {
+        total, ntohl(*(const uint32_t *)merged),
+        ntohl(*(const uint32_t *)&merged[size - logRecordSize]), 0};
+    if (distinct[0]->blocks)
+      block = malloc(codec_bound((int)size, logRecordSize));
+    if (block != NULL)
+      done = archive_put(writer, hour, block,
+                         codec_encode(merged, (int)size, logRecordSize, block),
+                         &summary);
+    else
+      done = archive_put(writer, hour, merged, size, &summary);
+  }
+  for (index = 0; index < kept; index++)
+    free(records[index]);
+  free(merged);
+  free(block);
+  return done && (merged != NULL);
+}
+
+static void dayDirectory(log_t *logger, time_t day, char *path) {
+  struct tm tm;
+  gmtime_r(&day, &tm);
+  sprintf(path, "%s%4.4lu/%2.2u/%2.2u", logger->basePath,
+          1900L + tm.tm_year, tm.tm_mon + 1, tm.tm_mday);
+}
+
+// remove the hour files listed in loose, with their indexes, and the day
+// directory once empty
+static void removeDay(const char *directory, uint32_t loose) {
+  char path[log_kMaxStrLen * 4];
+  int hour;
+  for (hour = 0; hour < 24; hour++) {
+    sprintf(path, "%s/%2.2u.idx", directory, hour);
+    unlink(path);
+    if (loose & (1UL << hour)) {
+      sprintf(path, "%s/%2.2u.dat", directory, hour);
+      unlink(path);
+    }
+  }
+  sprintf(path, "%s/day.idx", directory);
+  unlink(path);
+  rmdir(directory);
+}
+
+// pack the days from start into the archive at path, one day's or a
+// month's, along with any archive already there and, for a month, its
+// daily archives, returns the hour files packed or -1 on failure
+static long packDays(log_t *logger, const char *path, time_t start,
+                     int days) {
+  int logRecordSize = logger->recordSize;
+  archive_writer_t *writer = archive_create(path, start, days * 24);
+  if (writer == NULL)
+    return -1;
+  archive_t previous, daily;
+  archive_init(&previous);
+  archive_init(&daily);
+  archive_open(&previous, path);
+  char directory[log_kMaxStrLen * 2];
+  char dailyPath[log_kMaxStrLen * 2 + 8];
+  uint32_t loose[31];
+  long packed = 0;
+  bool done = true;
+  int day;
+  for (day = 0; done && (day < days); day++) {
+    time_t dayStart = start + (time_t)day * 86400;
+    dayDirectory(logger, dayStart, directory);
+    loose[day] = listDirectory(directory, NULL);
+    if (days > 1) {
+      sprintf(dailyPath, "%s.ach", directory);
+      if (!archive_open(&daily, dailyPath))
+        archive_close(&daily);
+    }
+    int hour;
+    for (hour = 0; done && (hour < 24); hour++) {
+      time_t t = dayStart + (time_t)hour * 3600;
+      hourCopy_t copies[3];
+      int count = 0;
+      const archive_hour_t *held = archive_find(&previous, t);
+      if (held != NULL)
+        archivedCopy(&previous, held, &copies[count++]);
+      held = archive_find(&daily, t);
+      if (held != NULL)
+        archivedCopy(&daily, held, &copies[count++]);
+      int fd = -1;
+      if (loose[day] & (1UL << hour)) {
+        char filePath[log_kMaxStrLen * 2];
+        hourPath(logger, t, filePath);
+        fd = open(filePath, O_RDONLY);
+        struct stat sb;
+        done = (fd >= 0) && (fstat(fd, &sb) == 0) &&
+               summariseHour(fd, 0, sb.st_size, logRecordSize,
+                             &copies[count++]);
+        packed++;
+      }
+      done = done && packHour(writer, t, copies, count, logRecordSize);
+      if (fd >= 0)
+        close(fd);
+    }
+  }
+  archive_close(&previous);
+  archive_close(&daily);
+  if (!done || (writer->count == 0))
+    archive_abort(writer); // failed, or only empty hours
+  else
+    done = archive_finish(writer);
+  if (!done) {
+    fprintf(stderr, "Error : Log Compaction Of %s Failed\n", path);
+    return -1;
+  }
+  for (day = 0; day < days; day++) {
+    dayDirectory(logger, start + (time_t)day * 86400, directory);
+    removeDay(directory, loose[day]);
+    if (days > 1) {
+      sprintf(dailyPath, "%s.ach", directory);
+      unlink(dailyPath);
+    }
+  }
+  if (days > 1) {
+    dayDirectory(logger, start, directory);
+    *strrchr(directory, '/') = '\0';
+    rmdir(directory); // the month's, once empty
+  }
+  return packed;
+}
+
+// pack the hours of days (or months) that ended by before, and are closed,
+// into archives, which readers then take them from, returns the hour files
+// packed, 0 when another compaction of the log is running, -1 on failure
+// or for a logger opened with variable set
+long log_compact(log_t *logger, log_compact_t period, time_t before) {
+  if (period == log_kCompactNone)
+    return 0;
+  if (logger->variable)
+    return -1; // archives are packed and merged as fixed records
+  struct timespec now;
+  readClock(logger, &now);
+  time_t cutoff = secondsToHour(now.tv_sec); // the hour being written
+  if ((before > 0) && (before < cutoff))
+    cutoff = before;
+  char path[log_kMaxStrLen * 2];
+  sprintf(path, "%scompact.lock", logger->basePath);
+  int lock = open(path, O_RDWR | O_CREAT, 0666);
+  if (lock < 0)
+    return -1;
+  if (flock(lock, LOCK_EX | LOCK_NB) != 0) {
+    close(lock);
+    return 0;
+  }
+  hourWalk_t walk;
+  beginWalk(logger, &walk); // for the range of years
+  long packed = 0;
+  long year;
+  for (year = walk.firstYear; year <= walk.lastYear; year++) {
+    sprintf(path, "%s%4.4lu", logger->basePath, year);
+    uint32_t months = listDirectory(path, NULL);
+    int month;
+    for (month = 1; month <= 12; month++) {
+      if ((months & (1UL << month)) == 0)
+        continue;
+      struct tm tm = {.tm_year = year - 1900, .tm_mon = month - 1,
+                      .tm_mday = 1};
+      time_t monthStart = timegm(&tm);
+      tm.tm_mon++;
+      time_t monthEnd = timegm(&tm);
+      long hours = 0;
+      if (period == log_kCompactMonthly) {
+        if (monthEnd > cutoff)
+          continue;
+        sprintf(path, "%s%4.4lu/%2.2u.ach", logger->basePath, year, month);
+        hours = packDays(logger, path, monthStart,
+                         (int)((monthEnd - monthStart) / 86400));
+        packed += hours > 0 ? hours : 0;
+        continue;
+      }
+      sprintf(path, "%s%4.4lu/%2.2u", logger->basePath, year, month);
+      uint32_t days = listDirectory(path, NULL);
+      int day;
+      for (day = 1; day < 32; day++) {
+        time_t dayStart = monthStart + (time_t)(day - 1) * 86400;
+        if (((days & (1UL << day)) == 0) || (dayStart + 86400 > cutoff))
+          continue;
+        sprintf(path, "%s%4.4lu/%2.2u/%2.2u.ach", logger->basePath, year,
+                month, day);
+        hours = packDays(logger, path, dayStart, 1);
+        packed += hours > 0 ? hours : 0;
+      }
+    }
+  }
+  endWalk(&walk);
+  flock(lock, LOCK_UN);
+  close(lock);
+  return packed;
+}
+
+static void *compactTask(void *context) {
+  log_t *logger = (log_t *)context;
+  log_compact(logger, logger->compact, logger->compactBefore);
+  __atomic_store_n(&logger->compactBefore, 0, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+// pack the days before day in the background, unless the last compaction
+// is still running
+static void startCompaction(log_t *logger, time_t day) {
+  if (logger->compacting) {
+    if (__atomic_load_n(&logger->compactBefore, __ATOMIC_ACQUIRE) != 0)
+      return;
+    pthread_join(logger->compactThread, NULL);
+    logger->compacting = false;
+  }
+  logger->compactBefore = day;
+  logger->compacting =
+      pthread_create(&logger->compactThread, NULL, compactTask, logger) == 0;
 }
 
 // if (logger->fileIndex + logger->dataSize + sizeof(uint32_t) >=
@@ -1,7 +1,10 @@
 #ifndef LOG_H
 #define LOG_H
 
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <time.h>
 
 #ifdef __cplusplus
@@ -11,23 +14,369 @@ extern "C" {
 // maximum log record string
 #define log_kMaxStrLen (1024)
 
-// maximum log file buffer size
+// default write buffer and read window size, see log_open
 #define log_kFileBufferSize (1048576)
 
+// bytes of the source id leading each record of a logger using sources
+#define log_kSourceSize (4)
+
+// maximum sources in one filtered read
+#define log_kMaxQuerySources (16)
+#define log_kMaxFields (16)
+#define log_kMaxFieldName (32)
+
+// maximum producers attached to one logger
+#define log_kMaxProducers (64)
+
+// clock sources for commit timestamps, see log_setClock
+typedef enum {
+  log_kClockRealtime, // CLOCK_REALTIME
+  log_kClockCoarse,   // CLOCK_REALTIME_COARSE, cheaper at tick resolution
+  log_kClockAnchored, // CLOCK_MONOTONIC offset to realtime when selected
+  log_kClockUser      // caller supplied function
+} log_clock_t;
+
+typedef void (*log_clockFunction_t)(struct timespec *ts, void *context);
+
+// unit of record timestamps, which are 32 bits from the start of the hour
+typedef enum {
+  log_kMillis,
+  log_kMicros // an hour is 3.6e9 micros, so these still fit
+} log_resolution_t;
+
+// when a journaled logger forces its journal out to the device
+typedef enum {
+  log_kSyncNone,     // left to the kernel, survives a crash of the process
+  log_kSyncRecords,  // every syncEvery records
+  log_kSyncInterval  // every syncEvery milliseconds of commits
+} log_sync_t;
+
+// closed hour files packed into archives, see log_compact
+typedef enum {
+  log_kCompactNone,
+  log_kCompactDaily,  // a day's hours into YYYY/MM/DD.ach
+  log_kCompactMonthly // a month's hours into YYYY/MM.ach
+} log_compact_t;
+
+// what a commit does when the buffer is full and cannot be written out yet
+typedef enum {
+  log_kBlock,      // wait for the flush thread
+  log_kDropNewest, // drop the record being committed
+  log_kDropOldest  // drop the oldest quarter of the buffered records
+} log_overflow_t;
+
+// what the flush policy has done, see log_counters
+typedef struct {
+  uint64_t flushes;       // buffers written out
+  uint64_t fullFlushes;   // early because the buffer reached flushBytes
+  uint64_t timedFlushes;  // early because flushMillis passed
+  uint64_t blocked;       // early flushes that waited for the flush thread
+  uint64_t droppedNewest; // records dropped as they were committed
+  uint64_t droppedOldest; // buffered records dropped to make room
+  uint64_t lostRecords;   // given up on as their write kept failing
+} log_counters_t;
+
+// log2 buckets of a histogram, bucket 0 counts zeros, bucket b values in
+// [2^(b-1), 2^b) and the last bucket everything larger
+#define log_kHistogramBuckets (40)
+
+typedef struct {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[log_kHistogramBuckets];
+} log_histogram_t;
+
+// telemetry of one logger, see log_stats, only 64 bit counters
+typedef struct {
+  log_counters_t counters;
+  uint64_t records;            // records committed
+  uint64_t bytesWritten;       // bytes appended to hour files
+  uint64_t hoursWritten;       // hour files opened for writing
+  uint64_t hoursRead;          // hour files loaded for reading
+  uint64_t hoursCached;        // of those, served by the hour cache
+  log_histogram_t commitNanos; // log_commit, only with timing set
+  log_histogram_t flushNanos;  // write of a buffer to its hour file
+  log_histogram_t openNanos;   // open of an hour file for writing
+  log_histogram_t loadNanos;   // load of an hour file for reading
+  log_histogram_t seekNanos;   // log_seek, and log_read with timing set
+  log_histogram_t scanRecords; // records examined by a query or filtered read
+} log_stats_t;
+
+// value types held in record data
+typedef enum {
+  log_kInt16,
+  log_kUint16,
+  log_kInt32,
+  log_kUint32,
+  log_kFloat,
+  log_kDouble
+} log_type_t;
+
+// one value of each record's data, see log_setSchema
+typedef struct {
+  char name[log_kMaxFieldName];
+  int offset; // bytes into the data, after the source id of sourced loggers
+  log_type_t type;
+  bool bigEndian; // host byte order when false
+} log_field_t;
+
+// summary of one field over a time range or bucket, see log_aggregate,
+// min, max and mean are zero when count is
+typedef struct {
+  uint64_t count;
+  double min;
+  double max;
+  double sum;
+  double mean;
+} log_aggregate_t;
+
+// settings for log_open, zero fields take their defaults
+typedef struct {
+  const char *path;
+  int dataSize;
+  int bufferSize; // write buffer bytes, log_kFileBufferSize when 0
+  int windowSize; // bytes of an hour copied for reads, larger hours are
+                  // mapped, log_kFileBufferSize when 0
+  bool async;     // as log_beginAsync
+  bool mapped;    // as log_beginMapped
+  bool compress;  // as log_compress
+  bool sources;   // as log_useSources
+  bool journal;   // back write buffers with basePath/journal, records left
+                  // there by a crash are written out by the next log_open,
+                  // which returns false when it is in use or cannot open
+  log_sync_t sync;
+  int syncEvery;
+  log_clock_t clock;
+  log_clockFunction_t clockFunction;
+  void *clockContext;
+  // buffers are written out at the minute, or sooner once they hold
+  // flushBytes (bufferSize when 0) or their first record is flushMillis
+  // old (never when 0)
+  int flushBytes;
+  int flushMillis;
+  log_overflow_t overflow;
+  bool timing;           // time each commit and read, two clock reads each
+  const char *statsPath; // file stats are appended to as JSON lines
+  int statsSeconds;      // between appends, 60 when 0
+  log_compact_t compact; // packs closed days or months in the background
+                         // as the writer moves on to a new day
+  // publish commits to a shared memory ring readers tail with log_follow,
+  // holding the last liveRecords records (65536, and at least two write
+  // buffers' worth, when 0), with log_kDropOldest records are published as
+  // their buffer is written out as they may be dropped until then,
+  // log_open returns false when the ring cannot be created
+  bool live;
+  int liveRecords;
+  // records of up to dataSize bytes, committed with log_commitSize and
+  // framed with their size, reads return the size of each, not used with
+  // compress, sources, live or compact, nor by queries
+  bool variable;
+  // records stamped in micros, so samples taken faster than 1 kHz are not
+  // read as one instant, commits then return epoch micros, readers and
+  // followers must be opened with the same resolution
+  log_resolution_t resolution;
+} log_config_t;
+
 typedef struct {
   int fileSize;
   int fileIndex;
   time_t fileTime;
-  int dataSize;
+  time_t minuteStart; // bounds of fileTime, cached for the commit path
+  time_t hourStart;
+  log_clock_t clock;
+  log_clockFunction_t clockFunction;
+  void *clockContext;
+  struct timespec clockAnchor;
+  log_resolution_t resolution; // of record timestamps, see log_config_t
+  int dataSize;   // bytes callers commit and read
+  int recordSize; // bytes of each record, timestamp, source id and data
+  int bufferSize;
+  int windowSize;
+  // flush policy, see log_config_t
+  int flushBytes;
+  int flushMillis;
+  uint64_t flushDue; // epoch millis the buffer is written out by
+  log_overflow_t overflow;
+  // telemetry, see log_stats
+  bool timing;
+  log_stats_t stats;
+  log_stats_t statsBase; // totals at the last reset
+  log_stats_t dumpBase;  // totals at the last append to statsPath
+  pthread_mutex_t statsLock; // serialises moving either base
+  char *statsPath; // NULL when not dumping
+  int statsSeconds;
+  time_t statsDue;
   char basePath[log_kMaxStrLen];
-  unsigned char fileBuffer[log_kFileBufferSize];
+  // hour file kept open by the writer
+  int writeFd;
+  time_t writeHour;
+  time_t writeDay;  // day whose directory is known to exist
+  bool writeBlocks; // hour file takes compressed blocks
+  uint32_t writeStream; // bytes of records in it, decoded from blocks
+  int indexFds[2];  // day manifest and hour index, see index_append
+  // write ahead journal holding the write buffers, only used when opened
+  // with journal set
+  unsigned char *journal;
+  size_t journalSize;
+  int journalFd;
+  log_sync_t sync;
+  int syncEvery;
+  int unsynced;        // records committed since the last sync
+  uint64_t syncMillis; // commit time of the last sync
+  unsigned char *buffer; // active write buffer, pooled on the first commit
+  unsigned char *window; // copy of the hour being read, pooled on first read
+  const unsigned char *readBuffer; // hour being read, window or mapping
+  struct cache_block_s *cached;    // hour being read, when from the cache
+  // mapped reads, only used when started with log_beginMapped
+  bool mapped;
+  void *mapping;
+  size_t mappingSize;
+  // compressed hour files, see log_compress
+  bool compress;
+  unsigned char *encodeBuffer;
+  unsigned char *decodeBuffer;
+  size_t decodeCapacity;
+  bool sourced; // records start with a source id, see log_useSources
+  struct archive_s *archive; // archive of the hour being read, see log_compact
+  // background compaction, only used when opened with compact set
+  log_compact_t compact;
+  bool compacting; // compactThread has been started and not yet joined
+  time_t compactBefore;
+  pthread_t compactThread;
+  // live tail, see log_follow
+  struct live_ring_s *live;   // published to, only opened with live set
+  struct live_ring_s *follow; // tailed by log_follow, attached on first use
+  uint64_t followNext;   // ring index after the record log_follow returned
+  uint64_t followMillis; // and that record's epoch time
+  // variable size records, only used when opened with variable set
+  bool variable;
+  int readSize; // data bytes of the record last read
+  int readPrev; // buffer index of the record before the cursor, -1 unknown
+  uint32_t *skips; // millis and buffer index of every index_kInterval'th
+                   // record of the hour being read
+  int skipCount;
+  int skipCapacity;
+  // record layout, see log_setSchema
+  log_field_t fields[log_kMaxFields];
+  int fieldCount;
+  // background flush, only used when started with log_beginAsync
+  bool async;
+  bool stop;
+  unsigned char *flushBuffer; // buffer being written by the flush thread
+  int flushIndex;
+  time_t flushTime;
+  pthread_t flushThread;
+  pthread_mutex_t flushLock;
+  pthread_cond_t flushReady; // flush buffer holds data or stop requested
+  pthread_cond_t flushDone;  // flush buffer has been written
+  // shared producers, only used once log_attach has been called
+  struct log_producer_s *producers;
+  pthread_mutex_t drainLock;
+  int64_t drainMinute; // minute up to which producer rings are drained
 } log_t;
 
+// records of one hour file passed to a log_query callback
+typedef struct {
+  time_t hour;                  // start of the hour
+  const unsigned char *records; // big endian time from hour, then data
+  int count;
+  int recordSize;
+  int unitsPerMilli; // of the record times, 1000 for micros resolution
+} log_block_t;
+
+// coverage of the hour files overlapping a time range, see log_extent
+typedef struct {
+  uint64_t first; // epoch millis of the first record
+  uint64_t last;  // epoch millis of the last record
+  uint64_t count; // records
+  int hours;      // hour files
+} log_extent_t;
+
+// return false to stop the query
+typedef bool (*log_callback_t)(const log_block_t *block, void *context);
+
+// per hour work of log_queryParallel, run on a pool thread, result is the
+// hour's zeroed result to fill in
+typedef void (*log_worker_t)(const log_block_t *block, void *result,
+                             void *context);
+
+// receives each hour of log_queryParallel in order, return false to stop
+typedef bool (*log_merge_t)(const log_block_t *block, const void *result,
+                            void *context);
+
+// text formats written by log_export
+typedef enum { log_kJson, log_kCsv } log_format_t;
+
+// per thread staging ring feeding a shared logger, see log_attach
+typedef struct log_producer_s {
+  struct log_producer_s *next;
+  log_t *logger;
+  unsigned char *ring; // records of epoch time (host order) and data
+  uint32_t records;    // ring capacity in records
+  uint32_t head;       // written by the producer, wraps at 2 * records
+  uint32_t tail;       // written by the drain, wraps at 2 * records
+  bool busy;           // producer is between its timestamp and publish
+} log_producer_t;
+
+bool log_open(log_t *logger, const log_config_t *config);
 void log_begin(log_t *logger, const char *logPath, int dataSize);
+bool log_beginAsync(log_t *logger, const char *logPath, int dataSize);
+void log_beginMapped(log_t *logger, const char *logPath, int dataSize);
+void log_setClock(log_t *logger, log_clock_t clock,
+                  log_clockFunction_t function, void *context);
+bool log_compress(log_t *logger, bool enable);
+void log_useSources(log_t *logger);
 uint64_t log_commit(log_t *logger, void* data);
+uint64_t log_commitBatch(log_t *logger, const struct timespec *ts,
+                         const void *records, size_t count);
+uint64_t log_commitSource(log_t *logger, uint32_t source, void *data);
+uint64_t log_commitSize(log_t *logger, const void *data, int size);
+uint64_t log_commitSizes(log_t *logger, const struct timespec *ts,
+                         const void *records, const int *sizes,
+                         size_t count);
 uint64_t log_millis(struct timespec *ts);
+uint64_t log_micros(struct timespec *ts);
 int log_read(log_t *logger, struct timespec *ts, void *data);
+bool log_seek(log_t *logger, struct timespec *ts);
+int log_next(log_t *logger, struct timespec *ts, void *data);
+int log_follow(log_t *logger, struct timespec *ts, void *data,
+               int timeoutMillis);
+int log_prev(log_t *logger, struct timespec *ts, void *data);
+const void *log_prevPtr(log_t *logger, struct timespec *ts);
+int log_latest(log_t *logger, int count, struct timespec *ts, void *data);
+const void *log_readPtr(log_t *logger, struct timespec *ts);
+const void *log_nextPtr(log_t *logger, struct timespec *ts);
+long log_query(log_t *logger, uint64_t start, uint64_t end,
+               log_callback_t callback, void *context);
+long log_queryParallel(log_t *logger, uint64_t start, uint64_t end,
+                       int threads, log_worker_t worker, size_t resultSize,
+                       log_merge_t merge, void *context);
+bool log_extent(log_t *logger, uint64_t start, uint64_t end,
+                log_extent_t *extent);
+int log_readSource(log_t *logger, struct timespec *ts, const uint32_t *sources,
+                   int count, uint32_t *source, void *data);
+int log_listSources(log_t *logger, uint64_t start, uint64_t end,
+                    uint32_t *sources, int maxSources);
+long log_export(log_t *logger, const uint32_t *sources, int count,
+                log_type_t type, uint64_t start, uint64_t end,
+                log_format_t format, FILE *out);
+bool log_setSchema(log_t *logger, const log_field_t *fields, int count);
+int log_field(log_t *logger, const char *name);
+long log_aggregate(log_t *logger, int field, uint64_t start, uint64_t end,
+                   uint64_t bucketMillis, int threads,
+                   log_aggregate_t *buckets, long maxBuckets);
+long log_compact(log_t *logger, log_compact_t period, time_t before);
+void log_counters(log_t *logger, log_counters_t *counters);
+void log_stats(log_t *logger, log_stats_t *stats, bool reset);
+void log_writeStats(const log_stats_t *stats, time_t time, FILE *out);
 void log_end(log_t *logger);
+void log_trim(void);
+void log_setCacheSize(size_t bytes);
+
+log_producer_t *log_attach(log_t *logger, int records);
+uint64_t log_commitFrom(log_producer_t *producer, void *data);
+void log_detach(log_producer_t *producer);
 
 #ifdef __cplusplus
 } // extern "C"
@@ -0,0 +1,77 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "pool.h"
+
+// Process wide free lists of log buffers. Loggers take their write buffer
+// on the first commit and readers their window on the first hour load,
+// handing them back at log_end, so many idle loggers and short lived
+// readers share a few buffers rather than each holding its own.
+
+#define kClasses (48)
+
+typedef struct block_s {
+  struct block_s *next;
+} block_t;
+
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static block_t *freeList[kClasses];
+static size_t retained;
+
+// size class of a request, the buffer size is 1 << class
+static int sizeClass(size_t size) {
+  if (size <= pool_kMinSize)
+    size = pool_kMinSize;
+  return 64 - __builtin_clzll((unsigned long long)size - 1);
+}
+
+// a buffer of at least size bytes, NULL when out of memory
+void *pool_get(size_t size) {
+  int class = sizeClass(size);
+  if (class >= kClasses)
+    return NULL;
+  pthread_mutex_lock(&poolLock);
+  block_t *block = freeList[class];
+  if (block != NULL) {
+    freeList[class] = block->next;
+    retained -= (size_t)1 << class;
+  }
+  pthread_mutex_unlock(&poolLock);
+  if (block != NULL)
+    return block;
+  return malloc((size_t)1 << class);
+}
+
+// return a buffer from pool_get, size as requested there
+void pool_put(void *buffer, size_t size) {
+  if (buffer == NULL)
+    return;
+  int class = sizeClass(size);
+  size_t bytes = (size_t)1 << class;
+  pthread_mutex_lock(&poolLock);
+  if (retained + bytes <= pool_kMaxRetained) {
+    block_t *block = (block_t *)buffer;
+    block->next = freeList[class];
+    freeList[class] = block;
+    retained += bytes;
+    buffer = NULL;
+  }
+  pthread_mutex_unlock(&poolLock);
+  free(buffer);
+}
+
+// free every retained buffer
+void pool_trim(void) {
+  int class;
+  pthread_mutex_lock(&poolLock);
+  for (class = 0; class < kClasses; class++) {
+    while (freeList[class] != NULL) {
+      block_t *block = freeList[class];
+      freeList[class] = block->next;
+      free(block);
+    }
+  }
+  retained = 0;
+  pthread_mutex_unlock(&poolLock);
+}
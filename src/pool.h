@@ -0,0 +1,16 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+// smallest buffer handed out, requests are rounded up to a power of two
+#define pool_kMinSize (4096)
+
+// free bytes kept for reuse across all size classes
+#define pool_kMaxRetained (64 * 1048576)
+
+void *pool_get(size_t size);
+void pool_put(void *buffer, size_t size);
+void pool_trim(void);
+
+#endif // POOL_H
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+#include "stats.h"
+
+// Counters and histograms are only ever added to, so a snapshot is the
+// running totals less the totals at the last reset. Maxima cannot be taken
+// apart that way and are cleared by the reset instead. The stats file has
+// a base of its own, so its appends leave the caller's snapshots alone,
+// its maxima are those since the caller's last reset.
+
+#define kCounters (sizeof(log_stats_t) / sizeof(uint64_t))
+
+static log_histogram_t *histogram(log_stats_t *stats, size_t index) {
+  log_histogram_t *histograms[] = {&stats->commitNanos, &stats->flushNanos,
+                                   &stats->openNanos,   &stats->loadNanos,
+                                   &stats->seekNanos,   &stats->scanRecords};
+  return index < sizeof(histograms) / sizeof(histograms[0]) ? histograms[index]
+                                                            : NULL;
+}
+
+// copy the stats gathered since base, moving base on to the totals when
+// asked, maxima are copied as they stand, caller holds statsLock
+static void takeStats(log_t *logger, log_stats_t *base, log_stats_t *stats,
+                      bool advance) {
+  const uint64_t *totals = (const uint64_t *)&logger->stats;
+  uint64_t *bases = (uint64_t *)base;
+  uint64_t *snapshot = (uint64_t *)stats;
+  size_t index;
+  for (index = 0; index < kCounters; index++) {
+    uint64_t total = __atomic_load_n(&totals[index], __ATOMIC_RELAXED);
+    snapshot[index] = total - bases[index];
+    if (advance)
+      bases[index] = total;
+  }
+  for (index = 0; histogram(stats, index) != NULL; index++)
+    histogram(stats, index)->max = __atomic_load_n(
+        &histogram(&logger->stats, index)->max, __ATOMIC_RELAXED);
+}
+
+// copy the stats gathered since the last reset, clearing them when asked
+void log_stats(log_t *logger, log_stats_t *stats, bool reset) {
+  size_t index;
+  pthread_mutex_lock(&logger->statsLock);
+  takeStats(logger, &logger->statsBase, stats, reset);
+  for (index = 0; reset && histogram(stats, index) != NULL; index++)
+    __atomic_store_n(&histogram(&logger->stats, index)->max, 0,
+                     __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&logger->statsLock);
+}
+
+static void writeHistogram(FILE *out, const char *name,
+                           const log_histogram_t *histogram) {
+  fprintf(out,
+          ",\"%s\":{\"count\":%llu,\"sum\":%llu,\"max\":%llu,"
+          "\"buckets\":[",
+          name, (unsigned long long)histogram->count,
+          (unsigned long long)histogram->sum,
+          (unsigned long long)histogram->max);
+  // trailing empty buckets are left out
+  int last = log_kHistogramBuckets;
+  while ((last > 0) && (histogram->buckets[last - 1] == 0))
+    last--;
+  int bucket;
+  for (bucket = 0; bucket < last; bucket++)
+    fprintf(out, "%s%llu", bucket ? "," : "",
+            (unsigned long long)histogram->buckets[bucket]);
+  fputs("]}", out);
+}
+
+// write stats as one line of JSON
+void log_writeStats(const log_stats_t *stats, time_t time, FILE *out) {
+  const log_counters_t *counters = &stats->counters;
+  fprintf(out,
+          "{\"time\":%lld,\"records\":%llu,\"bytesWritten\":%llu,"
+          "\"hoursWritten\":%llu,\"hoursRead\":%llu,\"hoursCached\":%llu,"
+          "\"flushes\":%llu,\"fullFlushes\":%llu,\"timedFlushes\":%llu,"
+          "\"blocked\":%llu,\"droppedNewest\":%llu,\"droppedOldest\":%llu,"
+          "\"lostRecords\":%llu",
+          (long long)time, (unsigned long long)stats->records,
+          (unsigned long long)stats->bytesWritten,
+          (unsigned long long)stats->hoursWritten,
+          (unsigned long long)stats->hoursRead,
+          (unsigned long long)stats->hoursCached,
+          (unsigned long long)counters->flushes,
+          (unsigned long long)counters->fullFlushes,
+          (unsigned long long)counters->timedFlushes,
+          (unsigned long long)counters->blocked,
+          (unsigned long long)counters->droppedNewest,
+          (unsigned long long)counters->droppedOldest,
+          (unsigned long long)counters->lostRecords);
+  writeHistogram(out, "commitNanos", &stats->commitNanos);
+  writeHistogram(out, "flushNanos", &stats->flushNanos);
+  writeHistogram(out, "openNanos", &stats->openNanos);
+  writeHistogram(out, "loadNanos", &stats->loadNanos);
+  writeHistogram(out, "seekNanos", &stats->seekNanos);
+  writeHistogram(out, "scanRecords", &stats->scanRecords);
+  fputs("}\n", out);
+}
+
+// append the stats of the last period to the stats file once it is due
+void stats_dump(log_t *logger, time_t now) {
+  if (now < logger->statsDue)
+    return;
+  logger->statsDue = now - now % logger->statsSeconds + logger->statsSeconds;
+  log_stats_t stats;
+  pthread_mutex_lock(&logger->statsLock);
+  takeStats(logger, &logger->dumpBase, &stats, true);
+  pthread_mutex_unlock(&logger->statsLock);
+  FILE *out = fopen(logger->statsPath, "a");
+  if (out == NULL) {
+    fprintf(stderr, "Error : Log Stats Write Failed\n");
+    return;
+  }
+  log_writeStats(&stats, now, out);
+  fclose(out);
+}
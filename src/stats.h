@@ -0,0 +1,38 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "log.h"
+
+// add to a counter read by other threads, committing, draining and flush
+// threads may all add to the same counter
+static inline void stats_add(uint64_t *counter, uint64_t value) {
+  __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+// count a value into its log2 bucket
+static inline void stats_record(log_histogram_t *histogram, uint64_t value) {
+  int bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+  if (bucket >= log_kHistogramBuckets)
+    bucket = log_kHistogramBuckets - 1;
+  stats_add(&histogram->buckets[bucket], 1);
+  stats_add(&histogram->count, 1);
+  stats_add(&histogram->sum, value);
+  uint64_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+  while ((value > max) &&
+         !__atomic_compare_exchange_n(&histogram->max, &max, value, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+static inline uint64_t stats_nanos(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void stats_dump(log_t *logger, time_t now);
+
+#endif // STATS_H
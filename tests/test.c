@@ -0,0 +1,1416 @@
+#define _GNU_SOURCE // nftw, open_memstream
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "index.h"
+#include "journal.h"
+#include "log.h"
+#include "pool.h"
+
+// Behaviour tests of the write paths and readers, each writing a tree
+// through the public API and reading it back, checking record counts and
+// order and the counters of the flush policy. A failed check reports what
+// it saw and the run fails when any did, which is what make check relies
+// on.
+
+#define kStart (1700006400000ULL) // 2023-11-15 00:00 UTC, epoch millis
+#define kMaxRecords (32768)
+
+typedef struct {
+  const char *path; // scratch directory, removed afterwards
+  int failures;
+} test_t;
+
+static uint64_t values[kMaxRecords];
+static uint64_t stamps[kMaxRecords];
+
+static void check(test_t *test, const char *name, uint64_t seen,
+                  uint64_t expected) {
+  if (seen == expected)
+    return;
+  fprintf(stderr, "Error : %s Saw %llu, Expected %llu\n", name,
+          (unsigned long long)seen, (unsigned long long)expected);
+  test->failures++;
+}
+
+static void checkText(test_t *test, const char *name, const char *seen,
+                      const char *expected) {
+  if (strcmp(seen, expected) == 0)
+    return;
+  fprintf(stderr, "Error : %s Saw\n%s\nExpected\n%s\n", name, seen,
+          expected);
+  test->failures++;
+}
+
+static void directory(const test_t *test, const char *name, char *path) {
+  snprintf(path, log_kMaxStrLen, "%s/%s", test->path, name);
+}
+
+static void setMillis(struct timespec *ts, uint64_t millis) {
+  ts->tv_sec = millis / 1000;
+  ts->tv_nsec = (millis % 1000) * 1000000;
+}
+
+// clock of a test stepping time itself, the time is the context
+static void fixedClock(struct timespec *ts, void *context) {
+  *ts = *(const struct timespec *)context;
+}
+
+// clock a millisecond on each time it is read, from any thread, the
+// context holds the epoch millis of the next read
+static void tickClock(struct timespec *ts, void *context) {
+  setMillis(ts, __atomic_fetch_add((uint64_t *)context, 1, __ATOMIC_RELAXED));
+}
+
+// read the tree at path from kStart, filling values with the first 8
+// bytes of each record's data and stamps with its epoch millis, returns
+// the records read
+static uint64_t readBack(const log_config_t *config) {
+  log_t logger;
+  log_open(&logger, config);
+  struct timespec ts;
+  setMillis(&ts, kStart - 1);
+  unsigned char data[64] = {0};
+  uint64_t count = 0;
+  while ((count < kMaxRecords) && log_read(&logger, &ts, data)) {
+    memcpy(&values[count], data, sizeof(uint64_t));
+    stamps[count] = log_millis(&ts);
+    count++;
+  }
+  log_end(&logger);
+  return count;
+}
+
+// records of readBack whose value is their index and which are step
+// millis apart from first
+static uint64_t inOrder(uint64_t count, uint64_t first, uint64_t step) {
+  uint64_t ordered = 0;
+  uint64_t index;
+  for (index = 0; index < count; index++)
+    ordered +=
+        (values[index] == index) && (stamps[index] == first + index * step);
+  return ordered;
+}
+
+static bool countBlock(const log_block_t *block, void *context) {
+  *(uint64_t *)context += block->count;
+  return true;
+}
+
+// an hour on disk the day manifest misses, as after a failed update, is
+// still read, queried and counted
+static void testManifest(test_t *test) {
+  char path[log_kMaxStrLen];
+  directory(test, "manifest", path);
+  log_t logger;
+  log_config_t config = {.path = path, .dataSize = 8};
+  log_open(&logger, &config);
+  struct timespec ts[3];
+  uint64_t records[3];
+  int index;
+  for (index = 0; index < 3; index++) {
+    setMillis(&ts[index], kStart + (uint64_t)index * 3600000);
+    records[index] = index;
+  }
+  log_commitBatch(&logger, ts, records, 3);
+  log_end(&logger);
+  // clear the summary of hour 01, the second of the 24 in day.idx
+  char manifest[log_kMaxStrLen + 32];
+  snprintf(manifest, sizeof(manifest), "%s/2023/11/15/day.idx", path);
+  uint32_t unknown[4] = {0};
+  int fd = open(manifest, O_WRONLY);
+  check(test, "manifestCleared",
+        pwrite(fd, unknown, sizeof(unknown), sizeof(unknown)),
+        sizeof(unknown));
+  close(fd);
+  uint64_t seen = readBack(&config);
+  check(test, "manifestRead", seen, 3);
+  check(test, "manifestOrder", inOrder(seen, kStart, 3600000), seen);
+  log_open(&logger, &config);
+  uint64_t queried = 0;
+  log_query(&logger, kStart, kStart + 3 * 3600000, countBlock, &queried);
+  check(test, "manifestQuery", queried, 3);
+  log_extent_t extent;
+  log_extent(&logger, kStart, kStart + 3 * 3600000, &extent);
+  check(test, "manifestExtent", extent.count, 3);
+  log_end(&logger);
+
+  // records appended to an hour file after its summary, as when a crash
+  // comes before the index update, are still queried and counted
+  directory(test, "manifestStale", path);
+  struct timespec stamps[10];
+  uint64_t values[10];
+  for (index = 0; index < 10; index++) {
+    setMillis(&stamps[index], kStart + (uint64_t)index * 1000);
+    values[index] = index;
+  }
+  log_open(&logger, &config);
+  log_commitBatch(&logger, stamps, values, 10);
+  log_end(&logger);
+  unsigned char appended[10 * 12];
+  for (index = 0; index < 10; index++) {
+    uint32_t millis = htonl(1800000 + index * 1000); // from 00:30
+    uint64_t value = 10 + index;
+    memcpy(&appended[index * 12], &millis, sizeof(millis));
+    memcpy(&appended[index * 12 + 4], &value, sizeof(value));
+  }
+  char hour[log_kMaxStrLen + 32];
+  snprintf(hour, sizeof(hour), "%s/2023/11/15/00.dat", path);
+  fd = open(hour, O_WRONLY | O_APPEND);
+  check(test, "manifestAppended", write(fd, appended, sizeof(appended)),
+        sizeof(appended));
+  close(fd);
+  log_open(&logger, &config);
+  queried = 0;
+  log_query(&logger, kStart + 1000000, kStart + 3600000, countBlock,
+            &queried);
+  check(test, "manifestStaleQuery", queried, 10);
+  log_extent(&logger, kStart, kStart + 3600000, &extent);
+  check(test, "manifestStaleExtent", extent.count, 20);
+  log_end(&logger);
+  // the next write rebuilds the index behind its file
+  log_open(&logger, &config);
+  setMillis(&stamps[0], kStart + 2400000);
+  log_commitBatch(&logger, stamps, values, 1);
+  log_end(&logger);
+  snprintf(hour, sizeof(hour), "%s/2023/11/15", path);
+  index_hour_t hours[24];
+  index_day(hour, hours);
+  check(test, "manifestRebuilt", hours[0].count, 21);
+}
+
+// log_beginAsync, buffers written by the flush thread as minutes roll over
+// the lines of a stats file and the sum of their flushes
+static uint64_t statsLines(const char *path, uint64_t *flushes) {
+  char line[4096];
+  uint64_t lines = 0;
+  *flushes = 0;
+  FILE *in = fopen(path, "r");
+  if (in == NULL)
+    return 0;
+  while (fgets(line, sizeof(line), in) != NULL) {
+    const char *field = strstr(line, "\"flushes\":");
+    if (field != NULL)
+      *flushes += strtoull(field + strlen("\"flushes\":"), NULL, 10);
+    lines++;
+  }
+  fclose(in);
+  return lines;
+}
+
+static void testAsync(test_t *test) {
+  char path[log_kMaxStrLen];
+  char statsPath[log_kMaxStrLen + 16];
+  directory(test, "async", path);
+  snprintf(statsPath, sizeof(statsPath), "%s/async.stats", test->path);
+  struct timespec now;
+  log_t logger;
+  log_config_t config = {.path = path, .dataSize = 8, .async = true,
+                         .clock = log_kClockUser, .clockFunction = fixedClock,
+                         .clockContext = &now, .statsPath = statsPath};
+  check(test, "asyncOpen", log_open(&logger, &config), true);
+  uint64_t first = kStart + 30000;
+  uint64_t count = 3000; // 50ms apart, over two minute boundaries
+  uint64_t index;
+  for (index = 0; index < count; index++) {
+    setMillis(&now, first + index * 50);
+    log_commit(&logger, &index);
+  }
+  // the stats file appends keep a base of their own
+  log_stats_t stats;
+  log_stats(&logger, &stats, false);
+  check(test, "asyncStatsKept", stats.records, count);
+  log_end(&logger);
+  log_counters_t counters;
+  log_counters(&logger, &counters);
+  check(test, "asyncFlushes", counters.flushes, 3);
+  // dumped by the flush thread after each write, once a minute
+  uint64_t flushes;
+  check(test, "asyncStats", statsLines(statsPath, &flushes), 3);
+  check(test, "asyncStatsFlushes", flushes, 3);
+  log_config_t reader = {.path = path, .dataSize = 8};
+  uint64_t seen = readBack(&reader);
+  check(test, "asyncRead", seen, count);
+  check(test, "asyncOrder", inOrder(seen, first, 50), seen);
+}
+
+typedef struct {
+  log_t *logger;
+  uint64_t thread;
+  uint64_t count;
+} producer_t;
+
+static void *produce(void *context) {
+  producer_t *work = context;
+  // a small ring, so producers also drain it themselves when it fills
+  log_producer_t *producer = log_attach(work->logger, 64);
+  if (producer == NULL)
+    return NULL;
+  uint64_t index;
+  for (index = 0; index < work->count; index++) {
+    uint64_t value = work->thread << 32 | index;
+    log_commitFrom(producer, &value);
+  }
+  log_detach(producer);
+  return NULL;
+}
+
+// log_attach producers on several threads merged into one time order
+static void testProducers(test_t *test) {
+  char path[log_kMaxStrLen];
+  directory(test, "producers", path);
+  uint64_t next = kStart + 55000; // across a minute
+  log_t logger;
+  log_config_t config = {.path = path, .dataSize = 8,
+                         .clock = log_kClockUser, .clockFunction = tickClock,
+                         .clockContext = &next};
+  log_open(&logger, &config);
+  check(test, "producersEmptyRing", log_attach(&logger, 0) == NULL, true);
+  pthread_t threads[4];
+  producer_t work[4];
+  int thread;
+  for (thread = 0; thread < 4; thread++) {
+    work[thread] = (producer_t){&logger, thread, 5000};
+    pthread_create(&threads[thread], NULL, produce, &work[thread]);
+  }
+  for (thread = 0; thread < 4; thread++)
+    pthread_join(threads[thread], NULL);
+  log_end(&logger);
+
+  log_config_t reader = {.path = path, .dataSize = 8};
+  uint64_t seen = readBack(&reader);
+  check(test, "producersRead", seen, 4 * 5000);
+  uint64_t expected[4] = {0};
+  uint64_t ordered = 0;
+  uint64_t index;
+  for (index = 0; index < seen; index++) {
+    uint64_t producer = values[index] >> 32;
+    if ((producer < 4) &&
+        ((values[index] & 0xffffffff) == expected[producer]))
+      expected[producer]++;
+    ordered += (index == 0) || (stamps[index] > stamps[index - 1]);
+  }
+  check(test, "producersOrder", ordered, seen);
+  for (thread = 0; thread < 4; thread++)
+    check(test, "producersSequence", expected[thread], 5000);
+}
+
+// a journaled writer killed with records in its journal, the next
+// log_open writes them out
+static void testJournal(test_t *test) {
+  char path[log_kMaxStrLen];
+  directory(test, "journal", path);
+  struct timespec now;
+  log_config_t config = {.path = path, .dataSize = 8, .journal = true,
+                         .sync = log_kSyncRecords,
+                         .clock = log_kClockUser, .clockFunction = fixedClock,
+                         .clockContext = &now};
+  uint64_t first = kStart + 50000;
+  uint64_t count = 400; // 100ms apart, the last 300 after a minute
+  pid_t child = fork();
+  if (child == 0) {
+    log_t logger;
+    log_open(&logger, &config);
+    uint64_t index;
+    for (index = 0; index < count; index++) {
+      setMillis(&now, first + index * 100);
+      log_commit(&logger, &index);
+    }
+    _exit(0); // without log_end
+  }
+  int status;
+  waitpid(child, &status, 0);
+  log_t logger;
+  check(test, "journalOpen", log_open(&logger, &config), true);
+  log_t second;
+  check(test, "journalInUse", log_open(&second, &config), false);
+  log_end(&second);
+  log_end(&logger);
+  char journal[log_kMaxStrLen + 16];
+  snprintf(journal, sizeof(journal), "%s/journal", path);
+  check(test, "journalRemoved", access(journal, F_OK) != 0, true);
+  log_config_t reader = {.path = path, .dataSize = 8};
+  uint64_t seen = readBack(&reader);
+  check(test, "journalRead", seen, count);
+  check(test, "journalOrder", inOrder(seen, first, 100), seen);
+}
+
+// Power loss is simulated by keeping a copy of the journal as the device
+// would hold it. This binary's msync and fdatasync stand in for the C
+// library's: msync also copies what it syncs, and fdatasync can crash the
+// writer, after which the copy replaces the journal.
+
+static int shadowFd = -1;          // copy of the journal while simulating
+static unsigned char *shadowBase;  // mapping of the journal, its first sync
+static int syncsBeforeCrash;       // fdatasync calls left, 0 never crashes
+static char journalPath[log_kMaxStrLen + 16];
+static char shadowPath[log_kMaxStrLen + 16];
+
+int msync(void *address, size_t length, int flags) {
+  if (shadowFd >= 0) {
+    if (shadowBase == NULL)
+      shadowBase = address;
+    pwrite(shadowFd, address, length,
+           (unsigned char *)address - shadowBase);
+  }
+  return syscall(SYS_msync, address, length, flags);
+}
+
+// lose power, the kernel having written back the records of the journal
+// but not its header, which only a sync guarantees
+static void powerLoss(void) {
+  struct stat sb;
+  if (stat(journalPath, &sb) == 0)
+    pwrite(shadowFd, shadowBase + journal_kHeaderSize,
+           sb.st_size - journal_kHeaderSize, journal_kHeaderSize);
+  rename(shadowPath, journalPath);
+  _exit(0);
+}
+
+int fdatasync(int fd) {
+  if ((syncsBeforeCrash > 0) && (--syncsBeforeCrash == 0))
+    powerLoss();
+  return syscall(SYS_fdatasync, fd);
+}
+
+// a journaled writer of sync losing power, after its hour file sync when
+// crashSyncs is not 0, commits count records 100ms apart from first, at
+// most 100 to a minute, returns the size of the hour file once the next
+// log_open has recovered the journal
+static off_t crashWriter(test_t *test, log_sync_t sync, int crashSyncs,
+                         uint64_t first, uint64_t count) {
+  char path[log_kMaxStrLen];
+  directory(test, "journalSync", path);
+  snprintf(journalPath, sizeof(journalPath), "%s/journal", path);
+  snprintf(shadowPath, sizeof(shadowPath), "%s/shadow", path);
+  struct timespec now;
+  log_config_t config = {.path = path, .dataSize = 8, .journal = true,
+                         .sync = sync, .syncEvery = 3600000,
+                         .clock = log_kClockUser, .clockFunction = fixedClock,
+                         .clockContext = &now};
+  if (sync == log_kSyncRecords)
+    config.syncEvery = 1;
+  mkdir(path, 0777);
+  pid_t child = fork();
+  if (child == 0) {
+    shadowFd = open(shadowPath, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    syncsBeforeCrash = crashSyncs;
+    log_t logger;
+    log_open(&logger, &config);
+    uint64_t index;
+    for (index = 0; index < count; index++) {
+      setMillis(&now, first + index * 100);
+      log_commit(&logger, &index);
+    }
+    powerLoss();
+  }
+  int status;
+  waitpid(child, &status, 0);
+  log_t logger;
+  log_open(&logger, &config);
+  log_end(&logger);
+  time_t seconds = first / 1000;
+  struct tm tm;
+  gmtime_r(&seconds, &tm);
+  char hour[log_kMaxStrLen + 64];
+  snprintf(hour, sizeof(hour), "%s/%d/%02d/%02d/%02d.dat", path,
+           1900 + tm.tm_year, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour);
+  struct stat sb;
+  return stat(hour, &sb) == 0 ? sb.st_size : 0;
+}
+
+// journal headers synced around each flush, so recovery after a power loss
+// neither writes flushed records again nor takes newer ones for them
+static void testJournalSync(test_t *test) {
+  char path[log_kMaxStrLen];
+  directory(test, "journalSync", path);
+  int recordSize = 8 + sizeof(uint32_t);
+  uint64_t first = kStart + 50000;
+  // between the write of the first minute and clearing its journal
+  off_t size = crashWriter(test, log_kSyncRecords, 1, first, 150);
+  check(test, "journalSyncFlushSize", size, 100 * recordSize);
+  log_config_t reader = {.path = path, .dataSize = 8};
+  uint64_t seen = readBack(&reader);
+  check(test, "journalSyncFlushRead", seen, 100);
+  check(test, "journalSyncFlushOrder", inOrder(seen, first, 100), seen);
+
+  // after the flush, with newer records in the buffer yet to be synced
+  first += 3600000;
+  size = crashWriter(test, log_kSyncInterval, 0, first, 120);
+  check(test, "journalSyncReuseSize", size, 100 * recordSize);
+}
+
+// commit count records 10ms apart from first through a logger of config
+// holding ten in its buffer, returns its counters
+static void commitTen(const log_config_t *config, uint64_t first,
+                      uint64_t count, log_counters_t *counters) {
+  struct timespec *now = config->clockContext;
+  log_t logger;
+  log_open(&logger, config);
+  uint64_t index;
+  for (index = 0; index < count; index++) {
+    setMillis(now, first + index * 10);
+    log_commit(&logger, &index);
+  }
+  log_counters(&logger, counters);
+  log_end(&logger);
+}
+
+// flushes ahead of the minute as the buffer fills or ages, and with the
+// hour files unwritable, records dropped as the overflow policy says
+// a file where the tree's directory should be fails every write until it
+// is removed, path is the tree under it
+static void block(const test_t *test, const char *name, char *blocker,
+                  char *path, size_t size) {
+  directory(test, name, blocker);
+  snprintf(path, size, "%s/log", blocker);
+  close(open(blocker, O_CREAT | O_WRONLY, 0666));
+}
+
+static void testOverflow(test_t *test) {
+  char path[log_kMaxStrLen + 8];
+  directory(test, "overflow", path);
+  int recordSize = 8 + sizeof(uint32_t);
+  struct timespec now;
+  log_config_t config = {.path = path, .dataSize = 8,
+                         .bufferSize = 11 * recordSize,
+                         .flushBytes = 10 * recordSize, .flushMillis = 500,
+                         .clock = log_kClockUser, .clockFunction = fixedClock,
+                         .clockContext = &now};
+  log_counters_t counters;
+  uint64_t first = kStart + 1000;
+  commitTen(&config, first, 25, &counters);
+  check(test, "overflowFullFlushes", counters.fullFlushes, 2);
+  log_t logger;
+  log_open(&logger, &config);
+  uint64_t index = 25;
+  setMillis(&now, first + 250);
+  log_commit(&logger, &index);
+  index++;
+  setMillis(&now, first + 1000); // the buffered record is 750ms old
+  log_commit(&logger, &index);
+  log_counters(&logger, &counters);
+  log_end(&logger);
+  check(test, "overflowTimedFlushes", counters.timedFlushes, 1);
+  log_config_t reader = {.path = path, .dataSize = 8};
+  check(test, "overflowRead", readBack(&reader), 27);
+
+  // with every write failing the buffer fills on past flushBytes before
+  // records are dropped
+  char blocker[log_kMaxStrLen];
+  block(test, "blockNewest", blocker, path, sizeof(path));
+  config.bufferSize = 20 * recordSize;
+  config.overflow = log_kDropNewest;
+  log_open(&logger, &config);
+  for (index = 0; index < 25; index++) {
+    setMillis(&now, first + index * 10);
+    log_commit(&logger, &index);
+  }
+  log_counters(&logger, &counters);
+  unlink(blocker);
+  log_end(&logger);
+  check(test, "overflowDroppedNewest", counters.droppedNewest, 5);
+  reader.path = path;
+  uint64_t seen = readBack(&reader);
+  check(test, "overflowDropNewestRead", seen, 20);
+  check(test, "overflowDropNewestOrder", inOrder(seen, first, 10), seen);
+
+  // a batch fills the buffer the same way
+  block(test, "blockBatch", blocker, path, sizeof(path));
+  struct timespec stamps[25];
+  uint64_t batch[25];
+  for (index = 0; index < 25; index++) {
+    setMillis(&stamps[index], first + index * 10);
+    batch[index] = index;
+  }
+  setMillis(&now, first);
+  log_open(&logger, &config);
+  log_commitBatch(&logger, stamps, batch, 25);
+  log_counters(&logger, &counters);
+  unlink(blocker);
+  log_end(&logger);
+  check(test, "overflowBatchDroppedNewest", counters.droppedNewest, 5);
+  seen = readBack(&reader);
+  check(test, "overflowBatchRead", seen, 20);
+
+  block(test, "blockOldest", blocker, path, sizeof(path));
+  config.overflow = log_kDropOldest;
+  first += 60000;
+  log_open(&logger, &config);
+  for (index = 0; index < 25; index++) {
+    setMillis(&now, first + index * 10);
+    log_commit(&logger, &index);
+  }
+  log_counters(&logger, &counters);
+  unlink(blocker);
+  log_end(&logger);
+  log_t cursor;
+  log_open(&cursor, &reader);
+  struct timespec ts;
+  setMillis(&ts, first - 1);
+  uint64_t value;
+  uint64_t kept = 0;
+  uint64_t newer = 0;
+  uint64_t last = 0;
+  while (log_read(&cursor, &ts, &value)) {
+    newer += (kept == 0) || (value > last);
+    last = value;
+    kept++;
+  }
+  log_end(&cursor);
+  check(test, "overflowDroppedOldest", counters.droppedOldest + kept, 25);
+  check(test, "overflowDroppedOldestFull", counters.droppedOldest, 5);
+  check(test, "overflowDropOldestOrder", newer, kept);
+  check(test, "overflowDropOldestLast", last, 24);
+  check(test, "overflowDropOldestNewest", counters.droppedNewest, 0);
+
+  // records the flush thread gives up on, and the last buffer, are counted
+  block(test, "blockLost", blocker, path, sizeof(path));
+  config.async = true;
+  config.overflow = log_kDropNewest;
+  log_open(&logger, &config);
+  for (index = 0; index < 25; index++) {
+    setMillis(&now, first + index * 10);
+    log_commit(&logger, &index);
+  }
+  log_end(&logger);
+  log_counters(&logger, &counters);
+  unlink(blocker);
+  check(test, "overflowLost", counters.lostRecords + counters.droppedNewest,
+        25);
+  check(test, "overflowLostRead", readBack(&reader), 0);
+}
+
+// export of rows as a string, of the count sources
+static void exportText(log_t *logger, const uint32_t *sources, int count,
+                       log_format_t format, char *text, size_t size) {
+  char *output = NULL;
+  size_t length = 0;
+  FILE *out = open_memstream(&output, &length);
+  log_export(logger, sources, count, log_kUint32, 0, UINT64_MAX, format,
+             out);
+  fclose(out);
+  snprintf(text, size, "%s", output);
+  free(output);
+}
+
+// a logger using sources commits and reads dataSize bytes of data, the
+// source ids kept apart from it
+static void testSources(test_t *test) {
+  char path[log_kMaxStrLen];
+  directory(test, "sources", path);
+  struct timespec now;
+  log_t logger;
+  log_config_t config = {.path = path, .dataSize = 8, .sources = true,
+                         .clock = log_kClockUser, .clockFunction = fixedClock,
+                         .clockContext = &now};
+  check(test, "sourcesOpen", log_open(&logger, &config), true);
+  uint64_t value = 7;
+  setMillis(&now, kStart + 1000);
+  log_commitSource(&logger, 3, &value);
+  value = 8;
+  setMillis(&now, kStart + 2000);
+  log_commit(&logger, &value);
+  log_end(&logger);
+  log_open(&logger, &config);
+  struct {
+    uint64_t value;
+    uint64_t guard; // past the data, never written
+  } read = {0, 0};
+  struct timespec ts;
+  setMillis(&ts, kStart);
+  check(test, "sourcesRead", log_read(&logger, &ts, &read.value), 8);
+  check(test, "sourcesValue", read.value, 7);
+  uint32_t source = UINT32_MAX;
+  check(test, "sourcesReadSource",
+        log_readSource(&logger, &ts, NULL, 0, &source, &read.value), 8);
+  check(test, "sourcesUnsourced", source, 0);
+  check(test, "sourcesUnsourcedValue", read.value, 8);
+  check(test, "sourcesGuard", read.guard, 0);
+  log_end(&logger);
+}
+
+// log_export as CSV and JSON, of a plain logger and one using sources
+static void testExport(test_t *test) {
+  char path[log_kMaxStrLen];
+  directory(test, "export", path);
+  struct timespec now;
+  log_t logger;
+  log_config_t config = {.path = path, .dataSize = 4,
+                         .clock = log_kClockUser, .clockFunction = fixedClock,
+                         .clockContext = &now};
+  log_open(&logger, &config);
+  uint32_t value;
+  for (value = 7; value < 10; value++) {
+    setMillis(&now, kStart + (value - 7) * 1250);
+    log_commit(&logger, &value);
+  }
+  log_end(&logger);
+  char text[1024];
+  char expected[1024];
+  log_open(&logger, &config);
+  exportText(&logger, NULL, 0, log_kCsv, text, sizeof(text));
+  snprintf(expected, sizeof(expected),
+           "millis,value\n%llu,7\n%llu,8\n%llu,9\n",
+           (unsigned long long)kStart, (unsigned long long)kStart + 1250,
+           (unsigned long long)kStart + 2500);
+  checkText(test, "exportCsv", text, expected);
+  exportText(&logger, NULL, 0, log_kJson, text, sizeof(text));
+  snprintf(expected, sizeof(expected),
+           "{\"sources\":[],\"timeseries\":[[%llu,7],[%llu,8],[%llu,9]]}",
+           (unsigned long long)kStart, (unsigned long long)kStart + 1250,
+           (unsigned long long)kStart + 2500);
+  checkText(test, "exportJson", text, expected);
+  // values wider than the data, or a negative count, are refused
+  FILE *out = fopen("/dev/null", "w");
+  check(test, "exportWide",
+        log_export(&logger, NULL, 0, log_kDouble, 0, UINT64_MAX, log_kCsv,
+                   out) < 0, true);
+  check(test, "exportNegative",
+        log_export(&logger, NULL, -1, log_kUint32, 0, UINT64_MAX, log_kCsv,
+                   out) < 0, true);
+  fclose(out);
+  log_end(&logger);
+
+  // sources sharing a millisecond share a row
+  directory(test, "exportSources", path);
+  config.sources = true;
+  log_open(&logger, &config);
+  setMillis(&now, kStart);
+  value = 10;
+  log_commitSource(&logger, 1, &value);
+  value = 20;
+  log_commitSource(&logger, 2, &value);
+  setMillis(&now, kStart + 1);
+  value = 11;
+  log_commitSource(&logger, 1, &value);
+  log_end(&logger);
+  static const uint32_t sources[] = {1, 2};
+  log_open(&logger, &config);
+  exportText(&logger, sources, 2, log_kCsv, text, sizeof(text));
+  snprintf(expected, sizeof(expected), "millis,1,2\n%llu,10,20\n%llu,11,\n",
+           (unsigned long long)kStart, (unsigned long long)kStart + 1);
+  checkText(test, "exportSourcesCsv", text, expected);
+  exportText(&logger, sources, 2, log_kJson, text, sizeof(text));
+  snprintf(expected, sizeof(expected),
+           "{\"sources\":[1,2],\"timeseries\":[[%llu,10,20],[%llu,11,null]]}",
+           (unsigned long long)kStart, (unsigned long long)kStart + 1);
+  checkText(test, "exportSourcesJson", text, expected);
+  log_end(&logger);
+}
+
+// log_follow of a writer opened with live set, from its hour files and
+// ring, until the writer ends
+static void testFollow(test_t *test) {
+  char path[log_kMaxStrLen];
+  directory(test, "follow", path);
+  struct timespec now;
+  log_t writer;
+  log_config_t config = {.path = path, .dataSize = 8, .live = true,
+                         .clock = log_kClockUser, .clockFunction = fixedClock,
+                         .clockContext = &now};
+  log_open(&writer, &config);
+  log_t follower;
+  log_config_t reader = {.path = path, .dataSize = 8};
+  log_open(&follower, &reader);
+  uint64_t first = kStart + 55000;
+  uint64_t index;
+  for (index = 0; index < 200; index++) { // a minute passes at 100
+    setMillis(&now, first + index * 50);
+    log_commit(&writer, &index);
+  }
+  struct timespec ts;
+  setMillis(&ts, first - 1);
+  uint64_t value;
+  uint64_t seen = 0;
+  uint64_t ordered = 0;
+  while (log_follow(&follower, &ts, &value, 0) != 0) {
+    ordered += (value == seen) && (log_millis(&ts) == first + seen * 50);
+    seen++;
+  }
+  check(test, "followRead", seen, 200);
+  for (; index < 250; index++) {
+    setMillis(&now, first + index * 50);
+    log_commit(&writer, &index);
+  }
+  while (log_follow(&follower, &ts, &value, 0) != 0) {
+    ordered += (value == seen) && (log_millis(&ts) == first + seen * 50);
+    seen++;
+  }
+  check(test, "followMore", seen, 250);
+  check(test, "followOrder", ordered, seen);
+  log_end(&writer);
+  check(test, "followEnded", log_follow(&follower, &ts, &value, 0), 0);
+  log_end(&follower);
+  check(test, "followDisk", readBack(&reader), 250);
+
+  // with log_kDropOldest records reach the ring only as they are written
+  // out, until then they may be dropped. A directory where the hour file
+  // should be fails every write
+  static const char *const levels[] = {"", "/2023", "/2023/11", "/2023/11/15",
+                                       "/2023/11/15/00.dat"};
+  char hour[log_kMaxStrLen + 32];
+  directory(test, "followDrop", path);
+  unsigned int level;
+  for (level = 0; level < sizeof(levels) / sizeof(levels[0]); level++) {
+    snprintf(hour, sizeof(hour), "%s%s", path, levels[level]);
+    mkdir(hour, 0777);
+  }
+  int recordSize = 8 + sizeof(uint32_t);
+  config.bufferSize = 11 * recordSize;
+  config.flushBytes = 10 * recordSize;
+  config.overflow = log_kDropOldest;
+  log_open(&writer, &config);
+  log_open(&follower, &reader);
+  for (index = 0; index < 25; index++) {
+    setMillis(&now, first + index * 10);
+    log_commit(&writer, &index);
+  }
+  setMillis(&ts, first - 1);
+  check(test, "followUnwritten", log_follow(&follower, &ts, &value, 0), 0);
+  rmdir(hour);
+  setMillis(&now, first + 60000); // the next minute writes out the buffer
+  log_commit(&writer, &index);
+  for (seen = 0; log_follow(&follower, &ts, &value, 0) != 0; seen++)
+    ;
+  log_counters_t counters;
+  log_counters(&writer, &counters);
+  check(test, "followDroppedOldest", seen + counters.droppedOldest, 25);
+  log_end(&writer);
+  log_end(&follower);
+}
+
+// a logger of micros resolution, whose first record of an hour can be
+// stamped with the magic of a compressed block
+static void testMicros(test_t *test) {
+  char path[log_kMaxStrLen];
+  directory(test, "micros", path);
+  log_t logger;
+  log_config_t config = {.path = path, .dataSize = 8,
+                         .resolution = log_kMicros};
+  log_open(&logger, &config);
+  uint64_t first = kStart * 1000 + 0x41434C42ULL; // "ACLB"
+  struct timespec ts[3];
+  uint64_t records[3];
+  int index;
+  for (index = 0; index < 3; index++) {
+    uint64_t micros = first + index * 20;
+    ts[index].tv_sec = micros / 1000000;
+    ts[index].tv_nsec = (micros % 1000000) * 1000;
+    records[index] = index;
+  }
+  log_commitBatch(&logger, ts, records, 3);
+  log_end(&logger);
+  log_open(&logger, &config);
+  struct timespec at = {first / 1000000 - 1, 0};
+  uint64_t value;
+  uint64_t seen = 0;
+  uint64_t ordered = 0;
+  while (log_read(&logger, &at, &value)) {
+    ordered += (value == seen) && (log_micros(&at) == first + seen * 20);
+    seen++;
+  }
+  check(test, "microsMagicRead", seen, 3);
+  check(test, "microsMagicOrder", ordered, seen);
+  log_extent_t extent;
+  log_extent(&logger, 0, UINT64_MAX, &extent);
+  check(test, "microsMagicExtent", extent.count, 3);
+  // exported in millis, as for any logger
+  char text[1024];
+  char expected[1024];
+  exportText(&logger, NULL, 0, log_kCsv, text, sizeof(text));
+  snprintf(expected, sizeof(expected),
+           "millis,value\n%llu.474,0\n%llu.494,1\n%llu.514,2\n",
+           (unsigned long long)first / 1000, (unsigned long long)first / 1000,
+           (unsigned long long)first / 1000);
+  checkText(test, "microsExportCsv", text, expected);
+  log_end(&logger);
+}
+
+// write count records whose value is their index, step millis apart from
+// first, through a logger of config
+static void writeRecords(const log_config_t *config, uint64_t first,
+                         uint64_t step, uint64_t count) {
+  struct timespec now;
+  log_config_t writer = *config;
+  writer.clock = log_kClockUser;
+  writer.clockFunction = fixedClock;
+  writer.clockContext = &now;
+  log_t logger;
+  log_open(&logger, &writer);
+  uint64_t index;
+  for (index = 0; index < count; index++) {
+    setMillis(&now, first + index * step);
+    log_commit(&logger, &index);
+  }
+  log_end(&logger);
+}
+
+// log_seek onto the first record later than a time, within an hour and
+// across an hour with no file, and log_next on from there
+static void testSeek(test_t *test) {
+  char path[log_kMaxStrLen];
+  directory(test, "seek", path);
+  log_config_t config = {.path = path, .dataSize = 8};
+  uint64_t later = kStart + 2 * 3600000ULL; // an hour on
+  writeRecords(&config, kStart, 3600, 1000);
+  writeRecords(&config, later, 3600, 1000);
+  log_t logger;
+  log_open(&logger, &config);
+  struct timespec ts;
+  uint64_t value = UINT64_MAX;
+  setMillis(&ts, kStart + 500 * 3600);
+  check(test, "seekExact", log_seek(&logger, &ts), true);
+  log_next(&logger, &ts, &value);
+  check(test, "seekExactValue", value, 501);
+  setMillis(&ts, kStart + 700 * 3600 + 1);
+  log_seek(&logger, &ts);
+  log_next(&logger, &ts, &value);
+  check(test, "seekBetweenValue", value, 701);
+  check(test, "seekBetweenTime", log_millis(&ts), kStart + 701 * 3600);
+  setMillis(&ts, kStart - 1);
+  log_seek(&logger, &ts);
+  log_next(&logger, &ts, &value);
+  check(test, "seekBeforeValue", value, 0);
+  // nothing later in the hour, or in the one without a file
+  setMillis(&ts, kStart + 999 * 3600);
+  check(test, "seekHourEnd", log_seek(&logger, &ts), true);
+  log_next(&logger, &ts, &value);
+  check(test, "seekHourEndTime", log_millis(&ts), later);
+  setMillis(&ts, kStart + 3600000ULL + 1000);
+  log_seek(&logger, &ts);
+  log_next(&logger, &ts, &value);
+  check(test, "seekGapTime", log_millis(&ts), later);
+  setMillis(&ts, kStart + 998 * 3600);
+  log_seek(&logger, &ts);
+  log_next(&logger, &ts, &value);
+  check(test, "seekNextValue", value, 999);
+  log_next(&logger, &ts, &value);
+  check(test, "seekNextAcross", log_millis(&ts), later);
+  setMillis(&ts, later + 999 * 3600);
+  check(test, "seekLast", log_seek(&logger, &ts), false);
+  log_end(&logger);
+}
+
+// hours larger than the read window are mapped rather than cut short,
+// and mapped readers point into the hour file
+static void testMapped(test_t *test) {
+  char path[log_kMaxStrLen];
+  directory(test, "mapped", path);
+  log_config_t config = {.path = path, .dataSize = 8};
+  uint64_t count = 3000; // 36000 bytes in one hour
+  writeRecords(&config, kStart, 1000, count);
+  log_config_t reader = {.path = path, .dataSize = 8, .windowSize = 4096};
+  uint64_t seen = readBack(&reader);
+  check(test, "mappedWindowRead", seen, count);
+  check(test, "mappedWindowOrder", inOrder(seen, kStart, 1000), seen);
+  reader.mapped = true;
+  log_t logger;
+  log_open(&logger, &reader);
+  struct timespec ts;
+  setMillis(&ts, kStart - 1);
+  const void *record;
+  uint64_t ordered = 0;
+  seen = 0;
+  while ((record = log_readPtr(&logger, &ts)) != NULL) {
+    uint64_t value;
+    memcpy(&value, record, sizeof(value));
+    ordered += (value == seen) && (log_millis(&ts) == kStart + seen * 1000);
+    seen++;
+  }
+  log_end(&logger);
+  check(test, "mappedRead", seen, count);
+  check(test, "mappedOrder", ordered, seen);
+}
+
+// bytes of the hour file of hour hours from kStart in the tree at path
+static uint64_t hourBytes(const char *path, int hour) {
+  char file[log_kMaxStrLen + 32];
+  snprintf(file, sizeof(file), "%s/2023/11/15/%2.2d.dat", path, hour);
+  struct stat sb;
+  return stat(file, &sb) == 0 ? (uint64_t)sb.st_size : 0;
+}
+
+// compressed hours are smaller and read, queried and counted as raw ones,
+// an hour begun raw carries on raw
+static void testCodec(test_t *test) {
+  char path[log_kMaxStrLen];
+  directory(test, "codec", path);
+  uint64_t recordSize = 8 + sizeof(uint32_t);
+  uint64_t count = 3000;
+  log_config_t config = {.path = path, .dataSize = 8, .compress = true};
+  writeRecords(&config, kStart, 1000, count);
+  check(test, "codecSmaller",
+        hourBytes(path, 0) < count * recordSize * 3 / 4, true);
+  log_config_t reader = {.path = path, .dataSize = 8};
+  uint64_t seen = readBack(&reader);
+  check(test, "codecRead", seen, count);
+  check(test, "codecOrder", inOrder(seen, kStart, 1000), seen);
+  log_t logger;
+  log_open(&logger, &reader);
+  uint64_t queried = 0;
+  log_query(&logger, 0, UINT64_MAX, countBlock, &queried);
+  check(test, "codecQuery", queried, count);
+  log_extent_t extent;
+  log_extent(&logger, 0, UINT64_MAX, &extent);
+  check(test, "codecExtent", extent.count, count);
+  log_end(&logger);
+
+  directory(test, "codecLegacy", path);
+  writeRecords(&reader, kStart, 1000, 100);
+  writeRecords(&config, kStart + 200000, 1000, 100);
+  check(test, "codecLegacyRaw", hourBytes(path, 0), 200 * recordSize);
+  writeRecords(&config, kStart + 3600000, 1000, 100);
+  check(test, "codecLegacyNext", hourBytes(path, 1) < 100 * recordSize,
+        true);
+  check(test, "codecLegacyRead", readBack(&reader), 300);
+
+  log_open(&logger, &reader);
+  check(test, "codecEnable", log_compress(&logger, true), true);
+  log_end(&logger);
+  log_config_t variable = {.path = path, .dataSize = 64, .variable = true};
+  log_open(&logger, &variable);
+  check(test, "codecVariable", log_compress(&logger, true), false);
+  log_end(&logger);
+}
+
+// log_open sizing of the write buffer and flush threshold, and buffers
+// reused through the pool by the next logger
+static void testSizing(test_t *test) {
+  char path[log_kMaxStrLen];
+  directory(test, "sizing", path);
+  int recordSize = 8 + sizeof(uint32_t);
+  log_t logger;
+  log_config_t config = {.path = path, .dataSize = 8};
+  log_open(&logger, &config);
+  check(test, "sizingDefault", logger.bufferSize, log_kFileBufferSize);
+  check(test, "sizingDefaultFlush", logger.flushBytes,
+        log_kFileBufferSize - 1);
+  log_end(&logger);
+  config.bufferSize = 1;
+  config.flushBytes = 1;
+  log_open(&logger, &config);
+  check(test, "sizingSmallest", logger.bufferSize, 2 * recordSize);
+  check(test, "sizingSmallestFlush", logger.flushBytes, recordSize);
+  log_end(&logger);
+
+  config.bufferSize = 5000;
+  config.flushBytes = 0;
+  log_open(&logger, &config);
+  uint64_t value = 1;
+  log_commit(&logger, &value);
+  void *buffer = logger.buffer;
+  log_end(&logger);
+  log_open(&logger, &config);
+  log_commit(&logger, &value);
+  check(test, "sizingPooled", logger.buffer == buffer, true);
+  log_end(&logger);
+  void *pooled = pool_get(5000);
+  void *other = pool_get(8192);
+  check(test, "sizingPoolHeld", other != pooled, true);
+  pool_put(other, 8192);
+  pool_put(pooled, 5000);
+  check(test, "sizingPoolClass", pool_get(8000) == pooled, true);
+  pool_put(pooled, 8000);
+  log_trim();
+}
+
+// hours merged by log_queryParallel, stopping after stopAfter when not 0
+typedef struct {
+  time_t last;
+  uint64_t records;
+  int hours;
+  int ordered;
+  int stopAfter;
+} merged_t;
+
+static void countWorker(const log_block_t *block, void *result,
+                        void *context) {
+  (void)context;
+  *(uint64_t *)result = block->count;
+}
+
+static bool mergeCount(const log_block_t *block, const void *result,
+                       void *context) {
+  merged_t *merged = (merged_t *)context;
+  uint64_t counted = *(const uint64_t *)result;
+  merged->ordered +=
+      (block->hour > merged->last) && (counted == (uint64_t)block->count);
+  merged->last = block->hour;
+  merged->records += counted;
+  merged->hours++;
+  return merged->hours != merged->stopAfter;
+}
+
+// hours worked on by a pool of threads are merged in hour order, with the
+// range cut to the records in it, and a merge can stop the query
+static void testParallel(test_t *test) {
+  char path[log_kMaxStrLen];
+  directory(test, "parallel", path);
+  log_config_t config = {.path = path, .dataSize = 8};
+  writeRecords(&config, kStart, 36000, 400); // 100 in each of four hours
+  log_t logger;
+  log_open(&logger, &config);
+  merged_t merged = {0};
+  uint64_t start = kStart + 18000; // after the first record
+  uint64_t end = kStart + 4 * 3600000ULL;
+  check(test, "parallelTotal",
+        log_queryParallel(&logger, start, end, 3, countWorker,
+                          sizeof(uint64_t), mergeCount, &merged),
+        399);
+  check(test, "parallelRecords", merged.records, 399);
+  check(test, "parallelHours", merged.hours, 4);
+  check(test, "parallelOrdered", merged.ordered, 4);
+  uint64_t queried = 0;
+  check(test, "parallelSerial",
+        log_query(&logger, start, end, countBlock, &queried), 399);
+  merged = (merged_t){.stopAfter = 2};
+  check(test, "parallelStopTotal",
+        log_queryParallel(&logger, 0, UINT64_MAX, 0, countWorker,
+                          sizeof(uint64_t), mergeCount, &merged),
+        200);
+  check(test, "parallelStopHours", merged.hours, 2);
+  log_end(&logger);
+}
+
+// log_aggregate buckets take records from their start up to the next's,
+// as many as fit, the same with or without threads
+static void testAggregate(test_t *test) {
+  char path[log_kMaxStrLen];
+  directory(test, "aggregate", path);
+  log_config_t config = {.path = path, .dataSize = 8};
+  writeRecords(&config, kStart, 1000, 600);
+  log_t logger;
+  log_open(&logger, &config);
+  log_field_t field = {.name = "value", .offset = 0, .type = log_kUint32};
+  check(test, "aggregateSchema", log_setSchema(&logger, &field, 1), true);
+  check(test, "aggregateField", log_field(&logger, "value"), 0);
+  log_aggregate_t buckets[10];
+  check(test, "aggregateBuckets",
+        log_aggregate(&logger, 0, kStart, kStart + 600000, 60000, 1, buckets,
+                      10),
+        10);
+  check(test, "aggregateCount", buckets[0].count, 60);
+  check(test, "aggregateMin", (uint64_t)buckets[1].min, 60);
+  check(test, "aggregateMax", (uint64_t)buckets[1].max, 119);
+  check(test, "aggregateSum", (uint64_t)buckets[0].sum, 1770);
+  check(test, "aggregateMean", (uint64_t)(buckets[0].mean * 2), 59);
+  // from a start between records, the record at the next bucket's start
+  // in that bucket
+  log_aggregate(&logger, 0, kStart + 500, kStart + 600000, 60000, 1,
+                buckets, 10);
+  check(test, "aggregateOffsetMin", (uint64_t)buckets[0].min, 1);
+  check(test, "aggregateOffsetMax", (uint64_t)buckets[0].max, 60);
+  check(test, "aggregateOffsetLast", buckets[9].count, 59);
+  log_aggregate(&logger, 0, kStart, kStart + 120000, 0, 0, buckets, 10);
+  check(test, "aggregateWhole", buckets[0].count, 120);
+  check(test, "aggregateWholeMax", (uint64_t)buckets[0].max, 119);
+  check(test, "aggregateFit",
+        log_aggregate(&logger, 0, kStart, kStart + 600000, 60000, 0,
+                      buckets, 3),
+        3);
+  check(test, "aggregateFitLast", (uint64_t)buckets[2].max, 179);
+  check(test, "aggregateNoField",
+        log_aggregate(&logger, 1, kStart, kStart + 600000, 0, 1, buckets,
+                      10) < 0,
+        true);
+  log_end(&logger);
+}
+
+// closed days packed into a daily archive, then merged with the month's
+// loose hours into a monthly one, read, queried and sought as before
+static void testCompact(test_t *test) {
+  char path[log_kMaxStrLen];
+  directory(test, "compact", path);
+  log_config_t config = {.path = path, .dataSize = 8};
+  uint64_t nextDay = kStart + 86400000ULL;
+  writeRecords(&config, kStart, 36000, 300);  // three hours
+  writeRecords(&config, nextDay, 36000, 200); // two the next day
+  char archive[log_kMaxStrLen + 32];
+  log_t logger;
+  log_open(&logger, &config);
+  check(test, "compactDaily",
+        log_compact(&logger, log_kCompactDaily, nextDay / 1000), 3);
+  snprintf(archive, sizeof(archive), "%s/2023/11/15.ach", path);
+  check(test, "compactDailyArchive", access(archive, F_OK), 0);
+  check(test, "compactDailyLoose", hourBytes(path, 0), 0);
+  check(test, "compactDailyRead", readBack(&config), 500);
+  uint64_t queried = 0;
+  log_query(&logger, 0, UINT64_MAX, countBlock, &queried);
+  check(test, "compactDailyQuery", queried, 500);
+  log_extent_t extent;
+  log_extent(&logger, 0, UINT64_MAX, &extent);
+  check(test, "compactDailyExtent", extent.count, 500);
+  struct timespec ts;
+  uint64_t value = UINT64_MAX;
+  setMillis(&ts, kStart + 150 * 36000 + 1);
+  log_seek(&logger, &ts);
+  log_next(&logger, &ts, &value);
+  check(test, "compactDailySeek", value, 151);
+  log_end(&logger);
+
+  log_open(&logger, &config);
+  check(test, "compactMonthly", log_compact(&logger, log_kCompactMonthly, 0),
+        2);
+  check(test, "compactMonthlyDaily", access(archive, F_OK) != 0, true);
+  snprintf(archive, sizeof(archive), "%s/2023/11.ach", path);
+  check(test, "compactMonthlyArchive", access(archive, F_OK), 0);
+  check(test, "compactMonthlyRead", readBack(&config), 500);
+  check(test, "compactAgain", log_compact(&logger, log_kCompactMonthly, 0),
+        0);
+  log_end(&logger);
+}
+
+// records read through the logger to its end from kStart
+static uint64_t readAll(log_t *logger) {
+  struct timespec ts;
+  setMillis(&ts, kStart - 1);
+  uint64_t value;
+  uint64_t count = 0;
+  while (log_read(logger, &ts, &value))
+    count++;
+  return count;
+}
+
+// readers of an hour share its decoded copy until the hour grows, the
+// copy a reader holds staying as it was
+static void testCache(test_t *test) {
+  char path[log_kMaxStrLen];
+  directory(test, "cache", path);
+  log_config_t config = {.path = path, .dataSize = 8, .compress = true};
+  writeRecords(&config, kStart, 1000, 100);
+  log_config_t reader = {.path = path, .dataSize = 8};
+  log_t first, second, grown;
+  log_open(&first, &reader);
+  log_open(&second, &reader);
+  check(test, "cacheFirstRead", readAll(&first), 100);
+  struct timespec ts;
+  uint64_t value;
+  setMillis(&ts, kStart - 1);
+  log_read(&second, &ts, &value);
+  check(test, "cacheShared",
+        (first.cached != NULL) && (first.cached == second.cached), true);
+  writeRecords(&config, kStart + 200000, 1000, 50);
+  log_open(&grown, &reader);
+  check(test, "cacheGrownRead", readAll(&grown), 150);
+  check(test, "cacheGrownCopy", grown.cached != second.cached, true);
+  uint64_t held = 1;
+  while (log_read(&second, &ts, &value))
+    held++;
+  check(test, "cacheHeldRead", held, 100);
+  log_end(&grown);
+  log_end(&second);
+  log_end(&first);
+}
+
+// log_prev back across an hour with no file, log_prevPtr handing
+// log_nextPtr the same record, and log_latest oldest first
+static void testReverse(test_t *test) {
+  char path[log_kMaxStrLen];
+  directory(test, "reverse", path);
+  log_config_t config = {.path = path, .dataSize = 8};
+  uint64_t later = kStart + 2 * 3600000ULL;
+  writeRecords(&config, kStart, 36000, 100); // the whole first hour
+  writeRecords(&config, later, 1000, 50);
+  log_t logger;
+  log_open(&logger, &config);
+  struct timespec ts;
+  uint64_t value;
+  setMillis(&ts, later + 3600000);
+  uint64_t count = 0;
+  uint64_t ordered = 0;
+  while (log_prev(&logger, &ts, &value)) {
+    uint64_t index = count < 50 ? 49 - count : 149 - count;
+    uint64_t millis =
+        count < 50 ? later + index * 1000 : kStart + index * 36000;
+    ordered += (value == index) && (log_millis(&ts) == millis);
+    count++;
+  }
+  check(test, "reverseRead", count, 150);
+  check(test, "reverseOrder", ordered, count);
+  setMillis(&ts, later + 10000);
+  log_seek(&logger, &ts);
+  const void *record = log_prevPtr(&logger, &ts);
+  memcpy(&value, record, sizeof(value));
+  check(test, "reversePrevPtr", value, 10);
+  record = log_nextPtr(&logger, &ts);
+  memcpy(&value, record, sizeof(value));
+  check(test, "reverseNextPtr", value, 10);
+
+  uint64_t latest[200];
+  struct timespec stamps[200];
+  check(test, "reverseLatest", log_latest(&logger, 10, stamps, latest), 10);
+  check(test, "reverseLatestFirst", latest[0], 40);
+  check(test, "reverseLatestLast", latest[9], 49);
+  check(test, "reverseLatestAcross",
+        log_latest(&logger, 60, stamps, latest), 60);
+  check(test, "reverseLatestAcrossFirst", latest[0], 90);
+  check(test, "reverseLatestAcrossTime", log_millis(&stamps[10]), later);
+  check(test, "reverseLatestAll",
+        log_latest(&logger, 200, stamps, latest), 150);
+  check(test, "reverseLatestAllFirst", log_millis(&stamps[0]), kStart);
+  log_end(&logger);
+}
+
+// bytes of the variable size record index, each of them its low byte
+static int frameSize(uint64_t index) {
+  return (int)(index % 64) + 1;
+}
+
+// records of varying size read back forwards and backwards, sought with
+// the skip index and committed in batches
+static void testVariable(test_t *test) {
+  char path[log_kMaxStrLen];
+  directory(test, "variable", path);
+  struct timespec now;
+  log_t logger;
+  log_config_t config = {.path = path, .dataSize = 64, .variable = true,
+                         .clock = log_kClockUser, .clockFunction = fixedClock,
+                         .clockContext = &now};
+  log_open(&logger, &config);
+  unsigned char data[64];
+  uint64_t count = 3000;
+  uint64_t index;
+  for (index = 0; index < count; index++) {
+    setMillis(&now, kStart + index * 1000);
+    memset(data, (int)(index & 0xff), sizeof(data));
+    log_commitSize(&logger, data, frameSize(index));
+  }
+  check(test, "variableTooLarge", log_commitSize(&logger, data, 65), 0);
+  struct timespec stamps[3];
+  int sizes[3] = {1, 64, 7};
+  unsigned char batch[72];
+  memset(batch, 0xee, sizeof(batch));
+  for (index = 0; index < 3; index++)
+    setMillis(&stamps[index], kStart + 3600000 + index * 10);
+  log_commitSizes(&logger, stamps, batch, sizes, 3);
+  log_end(&logger);
+
+  log_config_t reader = {.path = path, .dataSize = 64, .variable = true};
+  log_open(&logger, &reader);
+  struct timespec ts;
+  setMillis(&ts, kStart - 1);
+  uint64_t ordered = 0;
+  int size;
+  int last = 0;
+  for (index = 0; (size = log_read(&logger, &ts, data)) > 0; index++) {
+    ordered += (index < count) && (size == frameSize(index)) &&
+               (data[size - 1] == (index & 0xff)) &&
+               (log_millis(&ts) == kStart + index * 1000);
+    last = size;
+  }
+  check(test, "variableRead", index, count + 3);
+  check(test, "variableOrder", ordered, count);
+  check(test, "variableBatchLast", last, 7);
+  setMillis(&ts, kStart + 2000 * 1000 + 1);
+  log_seek(&logger, &ts);
+  size = log_next(&logger, &ts, data);
+  check(test, "variableSeek", size, frameSize(2001));
+  check(test, "variableSeekData", data[0], 2001 & 0xff);
+  setMillis(&ts, kStart + 3600000);
+  size = log_prev(&logger, &ts, data);
+  check(test, "variablePrev", size, frameSize(count - 1));
+  check(test, "variablePrevData", data[0], (count - 1) & 0xff);
+  uint64_t queried = 0;
+  check(test, "variableQuery",
+        log_query(&logger, 0, UINT64_MAX, countBlock, &queried) < 0, true);
+  log_end(&logger);
+}
+
+static int removeEntry(const char *path, const struct stat *sb, int flag,
+                       struct FTW *ftw) {
+  (void)sb;
+  (void)flag;
+  (void)ftw;
+  return remove(path);
+}
+
+// the writer keeps its hour file open across flushes, and builds a day
+// directory removed under it again
+static void testHourFile(test_t *test) {
+  char path[log_kMaxStrLen];
+  directory(test, "hourFile", path);
+  struct timespec now;
+  log_t logger;
+  log_config_t config = {.path = path, .dataSize = 8,
+                         .clock = log_kClockUser, .clockFunction = fixedClock,
+                         .clockContext = &now};
+  log_open(&logger, &config);
+  uint64_t index;
+  for (index = 0; index < 5; index++) {
+    setMillis(&now, kStart + index * 60000);
+    log_commit(&logger, &index);
+  }
+  log_stats_t stats;
+  log_stats(&logger, &stats, false);
+  check(test, "hourFileFlushes", stats.counters.flushes, 4);
+  check(test, "hourFileOpens", stats.hoursWritten, 1);
+  char day[log_kMaxStrLen + 16];
+  snprintf(day, sizeof(day), "%s/2023/11/15", path);
+  nftw(day, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+  for (; index < 10; index++) {
+    setMillis(&now, kStart + 3600000 + index * 60000);
+    log_commit(&logger, &index);
+  }
+  log_stats(&logger, &stats, false);
+  log_end(&logger);
+  check(test, "hourFileNextOpens", stats.hoursWritten, 2);
+  log_config_t reader = {.path = path, .dataSize = 8};
+  check(test, "hourFileRebuilt", readBack(&reader), 5);
+  check(test, "hourFileRebuiltFirst", values[0], 5);
+}
+
+int main(int argc, char **argv) {
+  char scratch[64];
+  snprintf(scratch, sizeof(scratch), "/tmp/acelog-test-%d", (int)getpid());
+  test_t test = {.path = scratch};
+  int option;
+  while ((option = getopt(argc, argv, "o:")) != -1) {
+    switch (option) {
+    case 'o':
+      test.path = optarg;
+      break;
+    default:
+      fprintf(stderr, "usage: acelog-test [-o scratch]\n");
+      return 2;
+    }
+  }
+  nftw(test.path, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+  mkdir(test.path, 0777);
+  testManifest(&test);
+  testAsync(&test);
+  testProducers(&test);
+  testJournal(&test);
+  testJournalSync(&test);
+  testOverflow(&test);
+  testSources(&test);
+  testExport(&test);
+  testFollow(&test);
+  testMicros(&test);
+  testSeek(&test);
+  testMapped(&test);
+  testCodec(&test);
+  testSizing(&test);
+  testParallel(&test);
+  testAggregate(&test);
+  testCompact(&test);
+  testCache(&test);
+  testReverse(&test);
+  testVariable(&test);
+  testHourFile(&test);
+  nftw(test.path, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+  if (test.failures == 0)
+    printf("acelog-test passed\n");
+  return test.failures == 0 ? 0 : 1;
+}
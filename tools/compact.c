@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+// Offline compaction, packs the closed days (or months) of a tree into
+// archives with log_compact. Every record is read before and after, and
+// the tool fails unless the same records come back. Prints a one line JSON
+// summary.
+
+typedef struct {
+  const char *path;
+  int dataSize;
+  bool sources;
+  log_compact_t period;
+  time_t before;
+} options_t;
+
+// count and FNV-1a hash of every record, in time order
+typedef struct {
+  uint64_t records;
+  uint64_t hash;
+} digest_t;
+
+static void usage(void) {
+  fprintf(stderr, "usage: acelog-compact -o path [-d dataSize] [-S] [-m]\n"
+                  "                      [-b before]\n");
+  exit(2);
+}
+
+static void parse(int argc, char **argv, options_t *options) {
+  *options = (options_t){.dataSize = 16, .period = log_kCompactDaily};
+  int option;
+  while ((option = getopt(argc, argv, "o:d:Smb:")) != -1) {
+    switch (option) {
+    case 'o':
+      options->path = optarg;
+      break;
+    case 'd':
+      options->dataSize = atoi(optarg);
+      break;
+    case 'S':
+      options->sources = true;
+      break;
+    case 'm':
+      options->period = log_kCompactMonthly;
+      break;
+    case 'b':
+      options->before = (time_t)atoll(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if ((options->path == NULL) || (options->dataSize <= 0))
+    usage();
+}
+
+static bool digestBlock(const log_block_t *block, void *context) {
+  digest_t *digest = (digest_t *)context;
+  size_t size = (size_t)block->count * block->recordSize;
+  size_t index;
+  for (index = 0; index < size; index++) {
+    digest->hash ^= block->records[index];
+    digest->hash *= 0x100000001b3ULL;
+  }
+  digest->records += block->count;
+  return true;
+}
+
+static void digestTree(log_t *logger, digest_t *digest) {
+  digest->records = 0;
+  digest->hash = 0xcbf29ce484222325ULL;
+  log_query(logger, 0, UINT64_MAX, digestBlock, digest);
+}
+
+int main(int argc, char **argv) {
+  options_t options;
+  parse(argc, argv, &options);
+
+  log_t logger;
+  log_config_t config = {.path = options.path,
+                         .dataSize = options.dataSize,
+                         .sources = options.sources};
+  log_open(&logger, &config);
+  digest_t before, after;
+  digestTree(&logger, &before);
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  long packed = log_compact(&logger, options.period, options.before);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  digestTree(&logger, &after);
+  log_end(&logger);
+
+  printf("{\"path\":\"%s\",\"period\":\"%s\",\"hourFiles\":%ld,"
+         "\"records\":%llu,\"seconds\":%.6f}\n",
+         options.path,
+         options.period == log_kCompactMonthly ? "monthly" : "daily", packed,
+         (unsigned long long)after.records,
+         (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9);
+  if ((packed < 0) || (after.records != before.records) ||
+      (after.hash != before.hash)) {
+    fprintf(stderr, "Error : Compaction Changed %llu Records To %llu\n",
+            (unsigned long long)before.records,
+            (unsigned long long)after.records);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,192 @@
+#include <arpa/inet.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+
+// Synthetic dataset generator, writes a YYYY/MM/DD/HH.dat tree through the
+// library with Poisson arrivals at a mean rate, whole hours left out at
+// random as gaps, and record data that drifts like sensor readings. Prints
+// a one line JSON summary and fails when the tree does not read back.
+
+#define kBatch (4096)
+
+typedef struct {
+  const char *path;
+  int dataSize;
+  double rate; // mean records per second
+  time_t start;
+  int hours;
+  int gapPercent; // chance of an hour without data
+  int sources;    // distinct source ids, 0 for a logger without sources
+  bool compress;
+  uint64_t seed;
+} options_t;
+
+static uint64_t state;
+
+// xorshift64*, deterministic for a given seed
+static uint64_t nextRandom(void) {
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return state * 0x2545F4914F6CDD1DULL;
+}
+
+// uniform in (0, 1]
+static double nextUniform(void) {
+  return ((nextRandom() >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: acelog-gen -o path [-d dataSize] [-r rate] [-s start]\n"
+          "                  [-H hours] [-g gapPercent] [-S sources] [-c]\n"
+          "                  [-x seed]\n");
+  exit(2);
+}
+
+static void parse(int argc, char **argv, options_t *options) {
+  *options = (options_t){.dataSize = 16,
+                         .rate = 10.0,
+                         .start = 1700006400, // 2023-11-15 00:00 UTC
+                         .hours = 48,
+                         .gapPercent = 10,
+                         .seed = 1};
+  int option;
+  while ((option = getopt(argc, argv, "o:d:r:s:H:g:S:cx:")) != -1) {
+    switch (option) {
+    case 'o':
+      options->path = optarg;
+      break;
+    case 'd':
+      options->dataSize = atoi(optarg);
+      break;
+    case 'r':
+      options->rate = atof(optarg);
+      break;
+    case 's':
+      options->start = (time_t)atoll(optarg);
+      break;
+    case 'H':
+      options->hours = atoi(optarg);
+      break;
+    case 'g':
+      options->gapPercent = atoi(optarg);
+      break;
+    case 'S':
+      options->sources = atoi(optarg);
+      break;
+    case 'c':
+      options->compress = true;
+      break;
+    case 'x':
+      options->seed = strtoull(optarg, NULL, 0);
+      break;
+    default:
+      usage();
+    }
+  }
+  if ((options->path == NULL) || (options->dataSize < (int)sizeof(int32_t)) ||
+      (options->rate <= 0) || (options->hours <= 0))
+    usage();
+}
+
+int main(int argc, char **argv) {
+  options_t options;
+  parse(argc, argv, &options);
+  state = options.seed ? options.seed : 1;
+
+  log_t logger;
+  log_config_t config = {.path = options.path,
+                         .dataSize = options.dataSize,
+                         .compress = options.compress,
+                         .sources = options.sources > 0};
+  log_open(&logger, &config);
+  // batched records lead with their source id when sourced
+  int recordSize =
+      options.dataSize + (options.sources > 0 ? log_kSourceSize : 0);
+  int words = options.dataSize / sizeof(int32_t);
+  int32_t *values = calloc(words, sizeof(int32_t));
+  struct timespec *stamps = malloc(kBatch * sizeof(struct timespec));
+  unsigned char *records = malloc((size_t)kBatch * recordSize);
+  if ((values == NULL) || (stamps == NULL) || (records == NULL))
+    return 1;
+
+  uint64_t written = 0;
+  int skipped = 0;
+  int count = 0;
+  int hour;
+  for (hour = 0; hour < options.hours; hour++) {
+    if ((int)(nextRandom() % 100) < options.gapPercent) {
+      skipped++;
+      continue;
+    }
+    double hourStart = (double)options.start + hour * 3600.0;
+    double t = hourStart - log(nextUniform()) / options.rate;
+    uint64_t last = 0;
+    for (; t < hourStart + 3600.0; t -= log(nextUniform()) / options.rate) {
+      struct timespec ts = {(time_t)t, (long)((t - floor(t)) * 1e9)};
+      uint64_t millis = log_millis(&ts);
+      if (millis == last)
+        continue; // one record per millisecond reads back reliably
+      last = millis;
+      unsigned char *record = &records[(size_t)count * recordSize];
+      if (options.sources > 0) {
+        uint32_t source = htonl((uint32_t)(nextRandom() % options.sources));
+        memcpy(record, &source, sizeof(source));
+        record += sizeof(source);
+      }
+      // a counter then slowly drifting readings
+      values[0]++;
+      int word;
+      for (word = 1; word < words; word++)
+        values[word] += (int32_t)(nextRandom() % 7) - 3;
+      memcpy(record, values, words * sizeof(int32_t));
+      memset(record + words * sizeof(int32_t), 0,
+             options.dataSize - words * sizeof(int32_t));
+      stamps[count++] = ts;
+      if (count == kBatch) {
+        log_commitBatch(&logger, stamps, records, count);
+        written += count;
+        count = 0;
+      }
+    }
+  }
+  log_commitBatch(&logger, stamps, records, count);
+  written += count;
+  log_end(&logger);
+  log_stats_t stats;
+  log_stats(&logger, &stats, false);
+
+  log_t reader;
+  log_config_t readerConfig = {.path = options.path,
+                               .dataSize = options.dataSize,
+                               .sources = config.sources};
+  log_open(&reader, &readerConfig);
+  log_extent_t extent = {0};
+  log_extent(&reader, (uint64_t)options.start * 1000ULL,
+             (uint64_t)(options.start + options.hours * 3600LL) * 1000ULL,
+             &extent);
+  log_end(&reader);
+
+  printf("{\"path\":\"%s\",\"dataSize\":%d,\"rate\":%g,\"start\":%lld,"
+         "\"hours\":%d,\"gapHours\":%d,\"sources\":%d,\"compress\":%s,"
+         "\"records\":%llu,\"bytes\":%llu,\"hourFiles\":%d}\n",
+         options.path, options.dataSize, options.rate,
+         (long long)options.start, options.hours, skipped, options.sources,
+         options.compress ? "true" : "false", (unsigned long long)written,
+         (unsigned long long)stats.bytesWritten, extent.hours);
+  free(values);
+  free(stamps);
+  free(records);
+  if (extent.count != written) {
+    fprintf(stderr, "Error : Generated %llu Records, Read Back %llu\n",
+            (unsigned long long)written, (unsigned long long)extent.count);
+    return 1;
+  }
+  return 0;
+}